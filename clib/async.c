@@ -0,0 +1,367 @@
+/*
+ * clib/async.c - coroutine based async tasks
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common/luaobject.h"
+#include "clib/async.h"
+#include "clib/luakit.h"
+#include "common/watchdog.h"
+#include "globalconf.h"
+
+#include <glib.h>
+#include <lauxlib.h>
+
+/* An async task is a coroutine started with async.run. Whenever the task
+ * calls one of the async primitives it registers a callback with whatever it
+ * waits on and yields back to the main loop, the callback then resumes the
+ * coroutine with the results. This turns callback based APIs into plain
+ * sequential code:
+ *
+ *   async.run(function ()
+ *       local reason, status = async.spawn("make")
+ *       async.sleep(500)
+ *       local rows = async.exec(db, "SELECT * FROM history;")
+ *   end)
+ *
+ * Note that (with plain Lua 5.1) a task can't yield from within a pcall or a
+ * metamethod. */
+
+typedef struct {
+    /* the task's coroutine */
+    lua_State *co;
+    /* keeps the coroutine alive while it is suspended */
+    gpointer ref;
+    /* id of the wait the task is suspended in (0 if none) */
+    guint wait;
+    /* the coroutine is running (i.e. hasn't yielded yet) */
+    gboolean running;
+    /* results of a callback which fired before the task yielded */
+    gpointer early;
+} async_task_t;
+
+/* all tasks by coroutine */
+static GHashTable *tasks;
+static guint last_wait;
+
+static async_task_t*
+async_checktask(lua_State *L)
+{
+    async_task_t *task = g_hash_table_lookup(tasks, L);
+    if (!task)
+        luaL_error(L, "not called from within an async task");
+    return task;
+}
+
+/* Resumes the task, `nargs` values on the coroutine's stack are returned
+ * from the primitive it is suspended in (or passed to the task function
+ * when the task is started). */
+static void
+async_task_step(lua_State *L, async_task_t *task, gint nargs)
+{
+    lua_State *co = task->co;
+
+    watchdog_attach(co);
+    task->running = TRUE;
+    gint status = lua_resume(co, nargs);
+    task->running = FALSE;
+
+    if (status == LUA_YIELD) {
+        /* discard yielded values, the task is woken by a callback */
+        lua_settop(co, 0);
+        return;
+    }
+
+    if (status) {
+        /* get a traceback of the failed task */
+        lua_getglobal(L, "debug");
+        lua_getfield(L, -1, "traceback");
+        lua_remove(L, -2);
+        lua_pushthread(co);
+        lua_xmove(co, L, 2);
+        lua_insert(L, -2);
+        lua_pcall(L, 2, 1, 0);
+        warn("error in async task: %s", lua_tostring(L, -1));
+        signal_object_emit(L, luakit_class.signals, "debug::error", 1, 0);
+    }
+
+    /* task finished */
+    g_hash_table_remove(tasks, co);
+    if (task->early)
+        luaH_object_unref(L, task->early);
+    luaH_object_unref(L, task->ref);
+    g_free(task);
+}
+
+/* Resumes the task with the `nargs` values on top of the stack */
+static void
+async_task_resume(lua_State *L, async_task_t *task, gint nargs)
+{
+    if (task->running) {
+        /* the callback fired before the task got to yield, save the results
+         * for async_task_suspend */
+        lua_createtable(L, nargs, 1);
+        lua_insert(L, -nargs - 1);
+        for (gint i = nargs; i > 0; i--)
+            lua_rawseti(L, -i - 1, i);
+        lua_pushinteger(L, nargs);
+        lua_setfield(L, -2, "n");
+        task->early = luaH_object_ref(L, -1);
+        return;
+    }
+
+    lua_xmove(L, task->co, nargs);
+    async_task_step(L, task, nargs);
+}
+
+/* Suspends the task until its callback fires. Must be returned from the
+ * calling C function. */
+static gint
+async_task_suspend(lua_State *L, async_task_t *task)
+{
+    if (!task->early)
+        return lua_yield(L, 0);
+
+    luaH_object_push(L, task->early);
+    luaH_object_unref(L, task->early);
+    task->early = NULL;
+
+    lua_getfield(L, -1, "n");
+    gint n = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    luaL_checkstack(L, n, "too many results");
+    for (gint i = 1; i <= n; i++)
+        lua_rawgeti(L, -i, i);
+    lua_remove(L, -n - 1);
+    return n;
+}
+
+/* Callback passed to callback based functions by luaH_async_await */
+static gint
+luaH_async_resume_cb(lua_State *L)
+{
+    lua_State *co = lua_tothread(L, lua_upvalueindex(1));
+    guint wait = lua_tointeger(L, lua_upvalueindex(2));
+    async_task_t *task = g_hash_table_lookup(tasks, co);
+
+    /* ignore repeated or stale callbacks */
+    if (!task || task->wait != wait)
+        return 0;
+
+    task->wait = 0;
+    async_task_resume(L, task, lua_gettop(L));
+    return 0;
+}
+
+/* Calls the function below the `nargs` arguments on top of the stack with a
+ * callback appended to its arguments and suspends the calling task until the
+ * callback is called, the callback's arguments are returned. Must be
+ * returned from the calling C function. */
+gint
+luaH_async_await(lua_State *L, gint nargs)
+{
+    async_task_t *task = async_checktask(L);
+    guint wait = task->wait = ++last_wait;
+
+    lua_pushthread(L);
+    lua_pushinteger(L, wait);
+    lua_pushcclosure(L, luaH_async_resume_cb, 2);
+    if (lua_pcall(L, nargs + 1, 0, 0)) {
+        task->wait = 0;
+        lua_error(L);
+    }
+    return async_task_suspend(L, task);
+}
+
+/* Starts a new task:
+ *   async.run(func, ...)
+ * The task runs until it first waits on something, returns the coroutine. */
+static gint
+luaH_async_run(lua_State *L)
+{
+    luaH_checkfunction(L, 1);
+    gint nargs = lua_gettop(L) - 1;
+
+    async_task_t *task = g_new0(async_task_t, 1);
+    task->co = lua_newthread(L);
+    lua_pushvalue(L, -1);
+    task->ref = luaH_object_ref(L, -1);
+    g_hash_table_insert(tasks, task->co, task);
+
+    /* move function & args to the coroutine */
+    lua_insert(L, 1);
+    lua_xmove(L, task->co, nargs + 1);
+    async_task_step(L, task, nargs);
+    return 1;
+}
+
+/* Generic adapter for callback based functions:
+ *   async.await(func, ...)
+ * calls func(..., callback) and returns the arguments the callback is called
+ * with. */
+static gint
+luaH_async_await_simple(lua_State *L)
+{
+    luaH_checkfunction(L, 1);
+    return luaH_async_await(L, lua_gettop(L) - 1);
+}
+
+static gboolean
+sleep_cb(async_task_t *task)
+{
+    task->wait = 0;
+    async_task_resume(globalconf.L, task, 0);
+    return FALSE;
+}
+
+/* Suspends the task for the given number of milliseconds:
+ *   async.sleep(ms) */
+static gint
+luaH_async_sleep(lua_State *L)
+{
+    async_task_t *task = async_checktask(L);
+    gint ms = luaL_checknumber(L, 1);
+    task->wait = ++last_wait;
+    g_timeout_add(MAX(ms, 0), (GSourceFunc) sleep_cb, task);
+    return lua_yield(L, 0);
+}
+
+/* Signal handler installed by async.wait, removes itself and resumes the
+ * task with the signal arguments */
+static gint
+luaH_async_signal_cb(lua_State *L)
+{
+    lua_State *co = lua_tothread(L, lua_upvalueindex(1));
+    guint wait = lua_tointeger(L, lua_upvalueindex(2));
+    async_task_t *task = g_hash_table_lookup(tasks, co);
+    gint nargs = lua_gettop(L);
+    lua_Debug ar;
+
+    /* remove this handler */
+    gboolean self = lua_isuserdata(L, lua_upvalueindex(3));
+    lua_pushvalue(L, lua_upvalueindex(3));
+    lua_getfield(L, -1, "remove_signal");
+    if (self)
+        lua_insert(L, -2);
+    else
+        lua_remove(L, -2);
+    lua_pushvalue(L, lua_upvalueindex(4));
+    lua_getstack(L, 0, &ar);
+    lua_getinfo(L, "f", &ar);
+    lua_call(L, self ? 3 : 2, 0);
+
+    if (task && task->wait == wait) {
+        task->wait = 0;
+        async_task_resume(L, task, nargs);
+    }
+    return 0;
+}
+
+/* Suspends the task until the object emits the signal:
+ *   async.wait(object, signame)
+ * returns the signal arguments. Works on objects and libraries with signals
+ * (i.e. luakit, soup). */
+static gint
+luaH_async_wait(lua_State *L)
+{
+    async_task_t *task = async_checktask(L);
+    luaL_checkstring(L, 2);
+    guint wait = task->wait = ++last_wait;
+
+    /* objects take self, libraries don't */
+    gboolean self = lua_isuserdata(L, 1);
+    lua_getfield(L, 1, "add_signal");
+    if (!lua_isfunction(L, -1))
+        luaL_argerror(L, 1, "object has no signals");
+    if (self)
+        lua_pushvalue(L, 1);
+    lua_pushvalue(L, 2);
+
+    lua_pushthread(L);
+    lua_pushinteger(L, wait);
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, 2);
+    lua_pushcclosure(L, luaH_async_signal_cb, 4);
+    lua_call(L, self ? 3 : 2, 0);
+
+    return async_task_suspend(L, task);
+}
+
+/* Spawns a command and waits for it to exit:
+ *   async.spawn(command)
+ * returns the same values as the luakit.spawn callback. */
+static gint
+luaH_async_spawn(lua_State *L)
+{
+    luaL_checkstring(L, 1);
+    lua_settop(L, 1);
+    lua_getglobal(L, "luakit");
+    lua_getfield(L, -1, "spawn");
+    lua_replace(L, -2);
+    lua_insert(L, 1);
+    return luaH_async_await(L, 1);
+}
+
+/* Runs a query in the sqlite3 query thread:
+ *   async.exec(db, sql)
+ * returns the rows & row count or nil and an error message. */
+static gint
+luaH_async_exec(lua_State *L)
+{
+    luaL_checkstring(L, 2);
+    lua_settop(L, 2);
+    lua_getfield(L, 1, "exec_async");
+    lua_insert(L, 1);
+    return luaH_async_await(L, 2);
+}
+
+/* Evaluates a script in an idle slice of the main loop:
+ *   async.eval_js(view, script [, opts])
+ * returns the result or nil and the exception message. */
+static gint
+luaH_async_eval_js(lua_State *L)
+{
+    luaL_checkstring(L, 2);
+    lua_settop(L, 3);
+    lua_getfield(L, 1, "eval_js_async");
+    lua_insert(L, 1);
+    return luaH_async_await(L, 3);
+}
+
+void
+async_lib_setup(lua_State *L)
+{
+    static const struct luaL_reg async_lib[] =
+    {
+        { "run",     luaH_async_run },
+        { "await",   luaH_async_await_simple },
+        { "sleep",   luaH_async_sleep },
+        { "wait",    luaH_async_wait },
+        { "spawn",   luaH_async_spawn },
+        { "exec",    luaH_async_exec },
+        { "eval_js", luaH_async_eval_js },
+        { NULL,      NULL }
+    };
+
+    tasks = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    /* export async lib */
+    luaH_openlib(L, "async", async_lib, async_lib);
+}
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
@@ -0,0 +1,188 @@
+/*
+ * clib/frame.c - WebKitWebFrame handle class
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "clib/frame.h"
+#include "clib/widget.h"
+#include "common/luaobject.h"
+#include "globalconf.h"
+#include "luah.h"
+
+#include <gtk/gtk.h>
+#include <webkit/webkitwebview.h>
+
+/* A frame object is created the first time a frame is pushed and is cached
+ * on the frame until it is destroyed, so the same frame always maps to the
+ * same (comparable & usable as table key) lua object. Once the frame is gone
+ * the object stays around as long as lua holds it but is marked invalid. */
+typedef struct {
+    LUA_OBJECT_HEADER
+    WebKitWebFrame *frame;
+    gpointer ref;
+} lframe_t;
+
+static lua_class_t frame_class;
+LUA_OBJECT_FUNCS(frame_class, lframe_t, frame)
+
+#define FRAME_DATA_KEY "luakit-frame"
+
+#define luaH_checklframe(L, idx) luaH_checkudata(L, idx, &(frame_class))
+
+static void
+frame_destroyed_cb(lframe_t *frame)
+{
+    frame->frame = NULL;
+    /* allow the object to be garbage collected */
+    luaH_object_unref(globalconf.L, frame->ref);
+    frame->ref = NULL;
+}
+
+gint
+luaH_frame_push(lua_State *L, WebKitWebFrame *f)
+{
+    if (!f) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lframe_t *frame = g_object_get_data(G_OBJECT(f), FRAME_DATA_KEY);
+    if (frame) {
+        luaH_object_push(L, frame->ref);
+        return 1;
+    }
+
+    frame = frame_new(L);
+    frame->frame = f;
+    /* keep the object alive for as long as the frame is */
+    lua_pushvalue(L, -1);
+    frame->ref = luaH_object_ref(L, -1);
+    g_object_set_data_full(G_OBJECT(f), FRAME_DATA_KEY, frame,
+            (GDestroyNotify) frame_destroyed_cb);
+    return 1;
+}
+
+/* Returns the frame of the frame object at the given index or NULL if the
+ * value isn't a frame object or the frame has been destroyed */
+WebKitWebFrame*
+luaH_toframe(lua_State *L, gint idx)
+{
+    lframe_t *frame = luaH_toudata(L, idx, &frame_class);
+    return frame ? frame->frame : NULL;
+}
+
+WebKitWebFrame*
+luaH_checkframe(lua_State *L, gint idx)
+{
+    lframe_t *frame = luaH_checklframe(L, idx);
+    if (!frame->frame)
+        luaL_argerror(L, idx, "frame destroyed");
+    return frame->frame;
+}
+
+static gint
+luaH_frame_get_uri(lua_State *L, lframe_t *frame)
+{
+    if (!frame->frame)
+        return 0;
+    lua_pushstring(L, webkit_web_frame_get_uri(frame->frame));
+    return 1;
+}
+
+static gint
+luaH_frame_get_name(lua_State *L, lframe_t *frame)
+{
+    if (!frame->frame)
+        return 0;
+    lua_pushstring(L, webkit_web_frame_get_name(frame->frame));
+    return 1;
+}
+
+static gint
+luaH_frame_get_parent(lua_State *L, lframe_t *frame)
+{
+    if (!frame->frame)
+        return 0;
+    return luaH_frame_push(L, webkit_web_frame_get_parent(frame->frame));
+}
+
+static gint
+luaH_frame_get_view(lua_State *L, lframe_t *frame)
+{
+    if (!frame->frame)
+        return 0;
+
+    /* the webview widget wraps the WebKitWebView in a scrolled window */
+    WebKitWebView *v = webkit_web_frame_get_web_view(frame->frame);
+    GtkWidget *parent = v ? gtk_widget_get_parent(GTK_WIDGET(v)) : NULL;
+    widget_t *w = parent ? g_object_get_data(G_OBJECT(parent), "lua_widget") : NULL;
+    if (!w)
+        return 0;
+
+    luaH_object_push(L, w->ref);
+    return 1;
+}
+
+static gint
+luaH_frame_get_valid(lua_State *L, lframe_t *frame)
+{
+    lua_pushboolean(L, frame->frame != NULL);
+    return 1;
+}
+
+void
+frame_class_setup(lua_State *L)
+{
+    static const struct luaL_reg frame_methods[] =
+    {
+        LUA_CLASS_METHODS(frame)
+        { NULL, NULL }
+    };
+
+    static const struct luaL_reg frame_meta[] =
+    {
+        LUA_OBJECT_META(frame)
+        LUA_CLASS_META
+        { "__gc", luaH_object_gc },
+        { NULL, NULL },
+    };
+
+    luaH_class_setup(L, &frame_class, "frame",
+            (lua_class_allocator_t) frame_new,
+            luaH_class_index_miss_property, luaH_class_newindex_miss_property,
+            frame_methods, frame_meta);
+
+    luaH_class_add_property(&frame_class, L_TK_URI,
+            NULL, (lua_class_propfunc_t) luaH_frame_get_uri, NULL);
+
+    luaH_class_add_property(&frame_class, L_TK_NAME,
+            NULL, (lua_class_propfunc_t) luaH_frame_get_name, NULL);
+
+    luaH_class_add_property(&frame_class, L_TK_PARENT,
+            NULL, (lua_class_propfunc_t) luaH_frame_get_parent, NULL);
+
+    luaH_class_add_property(&frame_class, L_TK_VIEW,
+            NULL, (lua_class_propfunc_t) luaH_frame_get_view, NULL);
+
+    luaH_class_add_property(&frame_class, L_TK_VALID,
+            NULL, (lua_class_propfunc_t) luaH_frame_get_valid, NULL);
+}
+
+#undef luaH_checklframe
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
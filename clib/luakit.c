@@ -21,10 +21,13 @@
 #include "common/signal.h"
 #include "clib/widget.h"
 #include "clib/luakit.h"
+#include "common/watchdog.h"
 #include "luah.h"
+#include "widgets/webview.h"
 
 #include <glib.h>
 #include <gtk/gtk.h>
+#include <signal.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <webkit/webkit.h>
@@ -280,6 +283,347 @@ void async_callback_handler(GPid pid, gint status, gpointer cb_ref) {
     g_spawn_close_pid(pid);
 }
 
+/* Output stream of a process spawned with luakit.spawn{...} */
+typedef struct {
+    struct spawn_proc_t *proc;
+    GIOChannel *channel;
+    guint watch;
+    /* called with each line or chunk of output */
+    gpointer callback;
+    /* partial last line (line mode only) */
+    GString *line;
+} spawn_stream_t;
+
+typedef struct spawn_proc_t {
+    GPid pid;
+    spawn_stream_t out;
+    spawn_stream_t err;
+    /* stdin pipe and the data still to be written to it */
+    GIOChannel *in;
+    guint in_watch;
+    gchar *input;
+    gsize input_len;
+    gsize input_pos;
+    /* kill timeout source */
+    guint timeout_id;
+    gboolean timed_out;
+    gboolean exited;
+    gint status;
+    gpointer on_exit;
+} spawn_proc_t;
+
+/* processes spawned with luakit.spawn{...} by pid */
+static GHashTable *spawn_procs;
+
+static GIOChannel*
+spawn_channel_new(gint fd)
+{
+    GIOChannel *c = g_io_channel_unix_new(fd);
+    g_io_channel_set_encoding(c, NULL, NULL);
+    g_io_channel_set_buffered(c, FALSE);
+    g_io_channel_set_flags(c, G_IO_FLAG_NONBLOCK, NULL);
+    g_io_channel_set_close_on_unref(c, TRUE);
+    return c;
+}
+
+static void
+spawn_call(lua_State *L, gpointer callback, gint nargs)
+{
+    luaH_object_push(L, callback);
+    lua_insert(L, -nargs - 1);
+    if (lua_pcall(L, nargs, 0, 0)) {
+        warn("error in spawn callback: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
+
+static void
+spawn_stream_emit(spawn_stream_t *s, const gchar *data, gsize len)
+{
+    lua_State *L = globalconf.L;
+    lua_pushlstring(L, data, len);
+    spawn_call(L, s->callback, 1);
+}
+
+static void
+spawn_stdin_close(spawn_proc_t *p)
+{
+    if (p->in_watch)
+        g_source_remove(p->in_watch);
+    if (p->in)
+        g_io_channel_unref(p->in);
+    g_free(p->input);
+    p->in = NULL;
+    p->in_watch = 0;
+    p->input = NULL;
+}
+
+/* Calls the exit callback and frees the process once it has exited and all
+ * of its output has been read */
+static void
+spawn_proc_check(spawn_proc_t *p)
+{
+    lua_State *L = globalconf.L;
+
+    if (!p->exited || p->out.watch || p->err.watch)
+        return;
+
+    if (p->timeout_id)
+        g_source_remove(p->timeout_id);
+    spawn_stdin_close(p);
+    g_hash_table_remove(spawn_procs, GINT_TO_POINTER(p->pid));
+
+    if (p->on_exit) {
+        if (p->timed_out) {
+            lua_pushliteral(L, "timeout");
+            lua_pushinteger(L, WIFSIGNALED(p->status) ? WTERMSIG(p->status) : -1);
+        } else if (WIFEXITED(p->status)) {
+            lua_pushliteral(L, "exit");
+            lua_pushinteger(L, WEXITSTATUS(p->status));
+        } else if (WIFSIGNALED(p->status)) {
+            lua_pushliteral(L, "signal");
+            lua_pushinteger(L, WTERMSIG(p->status));
+        } else {
+            lua_pushliteral(L, "unknown");
+            lua_pushinteger(L, -1);
+        }
+        spawn_call(L, p->on_exit, 2);
+        luaH_object_unref(L, p->on_exit);
+    }
+
+    luaH_object_unref(L, p->out.callback);
+    luaH_object_unref(L, p->err.callback);
+    if (p->out.line)
+        g_string_free(p->out.line, TRUE);
+    if (p->err.line)
+        g_string_free(p->err.line, TRUE);
+    g_free(p);
+}
+
+static gboolean
+spawn_read_cb(GIOChannel *c, GIOCondition cond, spawn_stream_t *s)
+{
+    (void) cond;
+    gchar buf[4096];
+    gsize n = 0;
+
+    GIOStatus status = g_io_channel_read_chars(c, buf, sizeof(buf), &n, NULL);
+
+    if (n && !s->line)
+        spawn_stream_emit(s, buf, n);
+    else if (n) {
+        /* emit all complete lines */
+        gchar *nl;
+        g_string_append_len(s->line, buf, n);
+        while ((nl = memchr(s->line->str, '\n', s->line->len))) {
+            gsize len = nl - s->line->str;
+            spawn_stream_emit(s, s->line->str, len);
+            g_string_erase(s->line, 0, len + 1);
+        }
+    }
+
+    if (status == G_IO_STATUS_NORMAL || status == G_IO_STATUS_AGAIN)
+        return TRUE;
+
+    /* eof or error, emit the unterminated last line */
+    if (s->line && s->line->len) {
+        spawn_stream_emit(s, s->line->str, s->line->len);
+        g_string_truncate(s->line, 0);
+    }
+    g_io_channel_unref(s->channel);
+    s->channel = NULL;
+    s->watch = 0;
+    spawn_proc_check(s->proc);
+    return FALSE;
+}
+
+static gboolean
+spawn_write_cb(GIOChannel *c, GIOCondition cond, spawn_proc_t *p)
+{
+    GIOStatus status = G_IO_STATUS_ERROR;
+    gsize n = 0;
+
+    if (!(cond & (G_IO_HUP | G_IO_ERR)))
+        status = g_io_channel_write_chars(c, p->input + p->input_pos,
+                p->input_len - p->input_pos, &n, NULL);
+    p->input_pos += n;
+
+    if (status == G_IO_STATUS_ERROR || p->input_pos >= p->input_len) {
+        /* closing stdin signals eof to the child */
+        p->in_watch = 0;
+        spawn_stdin_close(p);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void
+spawn_exit_cb(GPid pid, gint status, spawn_proc_t *p)
+{
+    g_spawn_close_pid(pid);
+    p->exited = TRUE;
+    p->status = status;
+    /* the pid may be reused, output can still arrive from grandchildren */
+    if (p->timeout_id) {
+        g_source_remove(p->timeout_id);
+        p->timeout_id = 0;
+    }
+    spawn_proc_check(p);
+}
+
+static gboolean
+spawn_timeout_cb(spawn_proc_t *p)
+{
+    p->timeout_id = 0;
+    if (p->exited)
+        return FALSE;
+    p->timed_out = TRUE;
+    kill(p->pid, SIGTERM);
+    return FALSE;
+}
+
+static void
+spawn_stream_init(lua_State *L, spawn_stream_t *s, spawn_proc_t *p,
+        const gchar *field, gboolean lines)
+{
+    s->proc = p;
+    lua_getfield(L, 1, field);
+    if (lua_isfunction(L, -1)) {
+        s->callback = luaH_object_ref(L, -1);
+        s->line = lines ? g_string_new(NULL) : NULL;
+    } else
+        lua_pop(L, 1);
+}
+
+/* Spawns a process with its output streamed to callbacks:
+ *   luakit.spawn{argv = {...} | "command", stdin = "...", on_stdout = fn,
+ *                on_stderr = fn, on_exit = fn, mode = "line" | "chunk",
+ *                timeout = ms, cwd = "..."}
+ * on_stdout and on_stderr are called with each line of output (without the
+ * newline) or each chunk read in "chunk" mode, streams without a callback
+ * are inherited from luakit. on_exit is called with the exit reason ("exit",
+ * "signal", "timeout" or "unknown") and the exit code or signal number once
+ * the process exited and all output has been delivered. A process still
+ * running after `timeout` ms is sent SIGTERM. Returns the pid which can be
+ * passed to luakit.kill. */
+static gint
+luaH_luakit_spawn_streaming(lua_State *L)
+{
+    GError *e = NULL;
+    gchar **argv = NULL;
+    gint in = -1, out = -1, err = -1;
+    size_t input_len = 0;
+
+    /* get argv */
+    lua_getfield(L, 1, "argv");
+    if (lua_istable(L, -1)) {
+        gint n = lua_objlen(L, -1);
+        /* check the elements first, luaL_checkstring would leak argv */
+        for (gint i = 0; i < n; i++) {
+            lua_rawgeti(L, -1, i + 1);
+            luaL_checkstring(L, -1);
+            lua_pop(L, 1);
+        }
+        argv = g_new0(gchar*, n + 1);
+        for (gint i = 0; i < n; i++) {
+            lua_rawgeti(L, -1, i + 1);
+            argv[i] = g_strdup(lua_tostring(L, -1));
+            lua_pop(L, 1);
+        }
+    } else if (!g_shell_parse_argv(luaL_checkstring(L, -1), NULL, &argv, &e)) {
+        lua_pushstring(L, e->message);
+        g_clear_error(&e);
+        lua_error(L);
+    }
+    lua_pop(L, 1);
+
+    if (!argv[0]) {
+        g_strfreev(argv);
+        luaL_error(L, "empty argv");
+    }
+
+    const gchar *input = luaH_getopt_lstring(L, 1, "stdin", NULL, &input_len);
+    const gchar *cwd = luaH_getopt_lstring(L, 1, "cwd", NULL, NULL);
+    const gchar *mode = luaH_getopt_lstring(L, 1, "mode", "line", NULL);
+    gint timeout = luaH_getopt_number(L, 1, "timeout", 0);
+    gboolean lines = g_strcmp0(mode, "chunk");
+
+    spawn_proc_t *p = g_new0(spawn_proc_t, 1);
+    spawn_stream_init(L, &p->out, p, "on_stdout", lines);
+    spawn_stream_init(L, &p->err, p, "on_stderr", lines);
+    lua_getfield(L, 1, "on_exit");
+    if (lua_isfunction(L, -1))
+        p->on_exit = luaH_object_ref(L, -1);
+    else
+        lua_pop(L, 1);
+
+    g_spawn_async_with_pipes(cwd, argv, NULL,
+            G_SPAWN_DO_NOT_REAP_CHILD|G_SPAWN_SEARCH_PATH, NULL, NULL,
+            &p->pid, input ? &in : NULL, p->out.callback ? &out : NULL,
+            p->err.callback ? &err : NULL, &e);
+    g_strfreev(argv);
+
+    if (e) {
+        luaH_object_unref(L, p->out.callback);
+        luaH_object_unref(L, p->err.callback);
+        luaH_object_unref(L, p->on_exit);
+        if (p->out.line)
+            g_string_free(p->out.line, TRUE);
+        if (p->err.line)
+            g_string_free(p->err.line, TRUE);
+        g_free(p);
+        lua_pushstring(L, e->message);
+        g_clear_error(&e);
+        lua_error(L);
+    }
+
+    if (out != -1) {
+        p->out.channel = spawn_channel_new(out);
+        p->out.watch = g_io_add_watch(p->out.channel,
+                G_IO_IN|G_IO_HUP|G_IO_ERR, (GIOFunc) spawn_read_cb, &p->out);
+    }
+
+    if (err != -1) {
+        p->err.channel = spawn_channel_new(err);
+        p->err.watch = g_io_add_watch(p->err.channel,
+                G_IO_IN|G_IO_HUP|G_IO_ERR, (GIOFunc) spawn_read_cb, &p->err);
+    }
+
+    if (in != -1) {
+        p->in = spawn_channel_new(in);
+        p->input = g_memdup(input, input_len);
+        p->input_len = input_len;
+        if (input_len)
+            p->in_watch = g_io_add_watch(p->in, G_IO_OUT|G_IO_HUP|G_IO_ERR,
+                    (GIOFunc) spawn_write_cb, p);
+        else
+            spawn_stdin_close(p);
+    }
+
+    if (timeout > 0)
+        p->timeout_id = g_timeout_add(timeout, (GSourceFunc) spawn_timeout_cb, p);
+
+    g_hash_table_insert(spawn_procs, GINT_TO_POINTER(p->pid), p);
+    g_child_watch_add(p->pid, (GChildWatchFunc) spawn_exit_cb, p);
+
+    lua_pushinteger(L, p->pid);
+    return 1;
+}
+
+/* Sends a signal (SIGTERM by default) to a process spawned with
+ * luakit.spawn{...}:
+ *   luakit.kill(pid [, signum])
+ * Returns true if the process was found and signalled. */
+static gint
+luaH_luakit_kill(lua_State *L)
+{
+    GPid pid = luaL_checkinteger(L, 1);
+    gint sig = luaL_optinteger(L, 2, SIGTERM);
+    spawn_proc_t *p = g_hash_table_lookup(spawn_procs, GINT_TO_POINTER(pid));
+    lua_pushboolean(L, p && !p->exited && !kill(pid, sig));
+    return 1;
+}
+
 /* Spawns a command.
  * \param L The Lua VM state. Contains a Lua function, the callback handler to use
  * when the command finishes.
@@ -288,6 +632,10 @@ void async_callback_handler(GPid pid, gint status, gpointer cb_ref) {
 static gint
 luaH_luakit_spawn(lua_State *L)
 {
+    /* table form with streamed output */
+    if (lua_istable(L, 1))
+        return luaH_luakit_spawn_streaming(L);
+
     GError *e = NULL;
     GPid pid = 0;
     const gchar *command = luaL_checkstring(L, 1);
@@ -422,40 +770,207 @@ luaH_luakit_quit(lua_State *L)
     return 0;
 }
 
-static gboolean
-idle_cb(gpointer func)
+/* Idle functions are run as cooperative tasks from a single idle source.
+ * Each main loop iteration runs queued tasks (highest priority first, round
+ * robin within a priority) until IDLE_BUDGET is used up. A task can yield
+ * (coroutine.yield()) to continue where it left off in a later iteration or
+ * return true to be run again from the start. */
+
+/* time (in µs) spent running idle tasks per main loop iteration */
+#define IDLE_BUDGET 5000
+
+typedef enum {
+    IDLE_PRIORITY_HIGH,
+    IDLE_PRIORITY_NORMAL,
+    IDLE_PRIORITY_LOW,
+    IDLE_PRIORITIES,
+} idle_priority_t;
+
+static const gchar *idle_priority_names[IDLE_PRIORITIES] = {
+    "high", "normal", "low",
+};
+
+typedef struct {
+    /* task function */
+    gpointer func;
+    /* coroutine of a started task (NULL until it is first run) */
+    lua_State *co;
+    gpointer co_ref;
+    /* name used for instrumentation */
+    gchar *name;
+    idle_priority_t priority;
+} idle_task_t;
+
+typedef struct {
+    guint runs;
+    guint yields;
+    /* time spent running the task (in ms) */
+    gdouble time;
+    /* longest single run (in ms) */
+    gdouble max;
+} idle_task_stats_t;
+
+static struct {
+    GQueue queues[IDLE_PRIORITIES];
+    /* tasks which already ran in the current pass of idle_cb */
+    GQueue ran[IDLE_PRIORITIES];
+    guint source;
+    /* task currently running and whether it has been removed meanwhile */
+    idle_task_t *current;
+    gboolean current_removed;
+    /* largest number of queued tasks seen */
+    guint max_depth;
+    /* idle_task_stats_t by task name */
+    GHashTable *stats;
+} idle;
+
+static guint
+idle_depth(void)
 {
-    lua_State *L = globalconf.L;
+    guint n = 0;
+    for (gint i = 0; i < IDLE_PRIORITIES; i++)
+        n += g_queue_get_length(&idle.queues[i])
+            + g_queue_get_length(&idle.ran[i]);
+    return n;
+}
 
-    /* get original stack size */
-    gint top = lua_gettop(L);
+static void
+idle_task_stop(lua_State *L, idle_task_t *task)
+{
+    if (task->co_ref)
+        luaH_object_unref(L, task->co_ref);
+    task->co = task->co_ref = NULL;
+}
+
+static void
+idle_task_free(lua_State *L, idle_task_t *task)
+{
+    idle_task_stop(L, task);
+    luaH_object_unref(L, task->func);
+    g_free(task->name);
+    g_free(task);
+}
+
+/* Runs the task until it yields or returns, returns TRUE if the task should
+ * be run again */
+static gboolean
+idle_task_run(lua_State *L, idle_task_t *task)
+{
     gboolean keep = FALSE;
 
-    /* call function */
-    luaH_object_push(L, func);
-    if (lua_pcall(L, 0, 1, 0))
-        /* remove idle source if error in callback */
-        warn("error in idle func: %s", lua_tostring(L, -1));
-    else
-        /* keep the source alive? */
-        keep = lua_toboolean(L, -1);
+    if (!task->co) {
+        task->co = lua_newthread(L);
+        task->co_ref = luaH_object_ref(L, -1);
+        luaH_object_push(task->co, task->func);
+    }
+
+    watchdog_attach(task->co);
+    gint64 start = g_get_monotonic_time();
+    gint status = lua_resume(task->co, 0);
+    gdouble ms = (g_get_monotonic_time() - start) / 1e3;
 
-    /* allow collection of idle callback func */
-    if (!keep)
-        luaH_object_unref(L, func);
+    idle_task_stats_t *stats = g_hash_table_lookup(idle.stats, task->name);
+    if (!stats) {
+        stats = g_new0(idle_task_stats_t, 1);
+        g_hash_table_insert(idle.stats, g_strdup(task->name), stats);
+    }
+    stats->runs++;
+    stats->time += ms;
+    stats->max = MAX(stats->max, ms);
+
+    if (status == LUA_YIELD) {
+        /* continue where the task left off next time */
+        lua_settop(task->co, 0);
+        stats->yields++;
+        return TRUE;
+    }
 
-    /* leave stack how we found it */
-    lua_settop(L, top);
+    if (status)
+        /* remove idle task if error in callback */
+        warn("error in idle func %s: %s", task->name,
+                lua_tostring(task->co, -1));
+    else
+        /* keep the task alive? */
+        keep = lua_gettop(task->co) && lua_toboolean(task->co, 1);
 
+    idle_task_stop(L, task);
     return keep;
 }
 
+static gboolean
+idle_cb(gpointer data)
+{
+    (void) data;
+    lua_State *L = globalconf.L;
+    gint64 start = g_get_monotonic_time();
+    idle_task_t *task;
+
+    do {
+        task = NULL;
+        for (gint i = 0; !task && i < IDLE_PRIORITIES; i++)
+            task = g_queue_pop_head(&idle.queues[i]);
+        if (!task)
+            break;
+
+        idle.current = task;
+        idle.current_removed = FALSE;
+        gboolean keep = idle_task_run(L, task);
+        idle.current = NULL;
+
+        /* tasks which aren't done yet are put back after the pass, so that
+         * each task runs at most once per main loop iteration */
+        if (keep && !idle.current_removed)
+            g_queue_push_tail(&idle.ran[task->priority], task);
+        else
+            idle_task_free(L, task);
+    } while (g_get_monotonic_time() - start < IDLE_BUDGET);
+
+    for (gint i = 0; i < IDLE_PRIORITIES; i++)
+        while ((task = g_queue_pop_head(&idle.ran[i])))
+            g_queue_push_tail(&idle.queues[i], task);
+
+    if (!idle_depth()) {
+        idle.source = 0;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Queues a function to be run when the main loop is idle:
+ *   luakit.idle_add(func [, opts])
+ * where opts is a table with the optional fields:
+ *   priority - "high", "normal" (default) or "low"
+ *   name     - name used in luakit.idle_stats() (defaults to the source
+ *              location of the function) */
 static gint
 luaH_luakit_idle_add(lua_State *L)
 {
     luaH_checkfunction(L, 1);
-    gpointer func = luaH_object_ref(L, 1);
-    g_idle_add(idle_cb, func);
+    idle_task_t *task = g_new0(idle_task_t, 1);
+    task->priority = IDLE_PRIORITY_NORMAL;
+
+    if (lua_istable(L, 2)) {
+        const gchar *p = luaH_getopt_lstring(L, 2, "priority", "normal", NULL);
+        for (gint i = 0; i < IDLE_PRIORITIES; i++)
+            if (!g_strcmp0(p, idle_priority_names[i]))
+                task->priority = i;
+        task->name = g_strdup(luaH_getopt_lstring(L, 2, "name", NULL, NULL));
+    }
+
+    if (!task->name) {
+        lua_Debug ar;
+        lua_pushvalue(L, 1);
+        lua_getinfo(L, ">S", &ar);
+        task->name = g_strdup_printf("%s:%d", ar.short_src, ar.linedefined);
+    }
+
+    lua_pushvalue(L, 1);
+    task->func = luaH_object_ref(L, -1);
+    g_queue_push_tail(&idle.queues[task->priority], task);
+    idle.max_depth = MAX(idle.max_depth, idle_depth());
+
+    if (!idle.source)
+        idle.source = g_idle_add(idle_cb, NULL);
     return 0;
 }
 
@@ -463,8 +978,70 @@ static gint
 luaH_luakit_idle_remove(lua_State *L)
 {
     luaH_checkfunction(L, 1);
-    gpointer func = luaH_object_ref(L, 1);
-    lua_pushboolean(L, g_idle_remove_by_data(func));
+    gconstpointer func = lua_topointer(L, 1);
+
+    if (idle.current && idle.current->func == func && !idle.current_removed) {
+        idle.current_removed = TRUE;
+        lua_pushboolean(L, TRUE);
+        return 1;
+    }
+
+    for (gint i = 0; i < IDLE_PRIORITIES * 2; i++) {
+        GQueue *q = (i < IDLE_PRIORITIES) ? &idle.queues[i]
+            : &idle.ran[i - IDLE_PRIORITIES];
+        for (GList *l = q->head; l; l = l->next) {
+            idle_task_t *task = l->data;
+            if (task->func == func) {
+                g_queue_delete_link(q, l);
+                idle_task_free(L, task);
+                lua_pushboolean(L, TRUE);
+                return 1;
+            }
+        }
+    }
+    lua_pushboolean(L, FALSE);
+    return 1;
+}
+
+/* Returns the idle task queue depth and the time spent per task name */
+static gint
+luaH_luakit_idle_stats(lua_State *L)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    lua_newtable(L);
+    lua_pushnumber(L, idle_depth());
+    lua_setfield(L, -2, "depth");
+    lua_pushnumber(L, idle.max_depth);
+    lua_setfield(L, -2, "max_depth");
+
+    lua_newtable(L);
+    for (gint i = 0; i < IDLE_PRIORITIES; i++) {
+        lua_pushnumber(L, g_queue_get_length(&idle.queues[i])
+                + g_queue_get_length(&idle.ran[i]));
+        lua_setfield(L, -2, idle_priority_names[i]);
+    }
+    lua_setfield(L, -2, "queued");
+
+    lua_newtable(L);
+    if (idle.stats) {
+        g_hash_table_iter_init(&iter, idle.stats);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            idle_task_stats_t *stats = value;
+            lua_newtable(L);
+            lua_pushnumber(L, stats->runs);
+            lua_setfield(L, -2, "runs");
+            lua_pushnumber(L, stats->yields);
+            lua_setfield(L, -2, "yields");
+            lua_pushnumber(L, stats->time);
+            lua_setfield(L, -2, "time");
+            lua_pushnumber(L, stats->max);
+            lua_setfield(L, -2, "max");
+            lua_setfield(L, -2, key);
+        }
+    }
+    lua_setfield(L, -2, "tasks");
     return 1;
 }
 
@@ -474,26 +1051,36 @@ luakit_lib_setup(lua_State *L)
     static const struct luaL_reg luakit_lib[] =
     {
         LUA_CLASS_METHODS(luakit)
-        { "__index",         luaH_luakit_index },
-        { "exec",            luaH_luakit_exec },
-        { "get_special_dir", luaH_luakit_get_special_dir },
-        { "quit",            luaH_luakit_quit },
-        { "save_file",       luaH_luakit_save_file },
-        { "set_selection",   luaH_luakit_set_selection },
-        { "get_selection",   luaH_luakit_get_selection },
-        { "spawn",           luaH_luakit_spawn },
-        { "spawn_sync",      luaH_luakit_spawn_sync },
-        { "time",            luaH_luakit_time },
-        { "uri_decode",      luaH_luakit_uri_decode },
-        { "uri_encode",      luaH_luakit_uri_encode },
-        { "idle_add",        luaH_luakit_idle_add },
-        { "idle_remove",     luaH_luakit_idle_remove },
-        { NULL,              NULL }
+        { "__index",           luaH_luakit_index },
+        { "exec",              luaH_luakit_exec },
+        { "get_special_dir",   luaH_luakit_get_special_dir },
+        { "quit",              luaH_luakit_quit },
+        { "save_file",         luaH_luakit_save_file },
+        { "set_selection",     luaH_luakit_set_selection },
+        { "get_selection",     luaH_luakit_get_selection },
+        { "spawn",             luaH_luakit_spawn },
+        { "spawn_sync",        luaH_luakit_spawn_sync },
+        { "kill",              luaH_luakit_kill },
+        { "time",              luaH_luakit_time },
+        { "uri_decode",        luaH_luakit_uri_decode },
+        { "uri_encode",        luaH_luakit_uri_encode },
+        { "idle_add",          luaH_luakit_idle_add },
+        { "idle_remove",       luaH_luakit_idle_remove },
+        { "idle_stats",        luaH_luakit_idle_stats },
+        { "register_script",   luaH_webview_register_script },
+        { "unregister_script", luaH_webview_unregister_script },
+        { "stats",             luaH_webview_push_all_stats },
+        { "load_timing",       luaH_webview_push_host_load_timing },
+        { "stall_stats",       luaH_watchdog_push_stats },
+        { NULL,                NULL }
     };
 
     /* create signals array */
     luakit_class.signals = signal_new();
 
+    idle.stats = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    spawn_procs = g_hash_table_new(g_direct_hash, g_direct_equal);
+
     /* export luakit lib */
     luaH_openlib(L, "luakit", luakit_lib, luakit_lib);
 }
@@ -0,0 +1,216 @@
+/*
+ * clib/soup/headers.c - per-domain request header rules
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "clib/soup/soup.h"
+#include "clib/soup/headers.h"
+#include "luah.h"
+
+#include <libsoup/soup-message.h>
+#include <libsoup/soup-session-feature.h>
+#include <libsoup/soup-uri.h>
+#include <string.h>
+
+static void luakit_header_rules_session_feature_init(SoupSessionFeatureInterface *interface, gpointer data);
+
+G_DEFINE_TYPE_WITH_CODE(LuakitHeaderRules, luakit_header_rules, G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE(SOUP_TYPE_SESSION_FEATURE, luakit_header_rules_session_feature_init))
+
+/* rules of this domain apply to all requests */
+#define GLOBAL_DOMAIN "*"
+
+/* most rule sets only touch a few domain levels, bail out on silly hosts */
+#define MAX_LABELS 16
+
+typedef struct {
+    gchar *name;
+    /* replacement value or NULL to remove the header */
+    gchar *value;
+} header_rule_t;
+
+static void
+header_rule_free(header_rule_t *r)
+{
+    g_free(r->name);
+    g_free(r->value);
+    g_free(r);
+}
+
+static void
+header_rules_free(GPtrArray *rules)
+{
+    g_ptr_array_foreach(rules, (GFunc) header_rule_free, NULL);
+    g_ptr_array_free(rules, TRUE);
+}
+
+static void
+apply_rules(SoupMessageHeaders *headers, GPtrArray *rules)
+{
+    header_rule_t *r;
+    for (guint i = 0; i < rules->len; i++) {
+        r = g_ptr_array_index(rules, i);
+        if (r->value)
+            soup_message_headers_replace(headers, r->name, r->value);
+        else
+            soup_message_headers_remove(headers, r->name);
+    }
+}
+
+/* Looks up the rules of every parent domain of the host (one hash lookup per
+ * label) and applies them from the least to the most specific domain so that
+ * rules for "www.example.com" override the rules for "example.com". */
+static void
+request_started(SoupSessionFeature *feature, SoupSession *session,
+        SoupMessage *msg, SoupSocket *socket)
+{
+    (void) session;
+    (void) socket;
+    LuakitHeaderRules *hr = LUAKIT_HEADER_RULES(feature);
+    GPtrArray *matched[MAX_LABELS + 1], *rules;
+    gint n = 0;
+
+    if (!g_hash_table_size(hr->domains))
+        return;
+
+    SoupURI *uri = soup_message_get_uri(msg);
+    const gchar *domain = uri ? uri->host : NULL;
+
+    while (domain && *domain && n < MAX_LABELS) {
+        if ((rules = g_hash_table_lookup(hr->domains, domain)))
+            matched[n++] = rules;
+        if ((domain = strchr(domain, '.')))
+            domain++;
+    }
+
+    if ((rules = g_hash_table_lookup(hr->domains, GLOBAL_DOMAIN)))
+        matched[n++] = rules;
+
+    while (n--)
+        apply_rules(msg->request_headers, matched[n]);
+}
+
+/* Replaces all header rules with the rules in the given table, which maps
+ * domain names (or "*" for all domains) to tables of header values where a
+ * value of false removes the header. Rules apply to the given domain and
+ * all of its subdomains.
+ *
+ *   soup.set_header_rules{
+ *       ["*"]           = { DNT = "1" },
+ *       ["example.com"] = { ["User-Agent"] = "Mozilla/5.0", Referer = false },
+ *   }
+ */
+gint
+luaH_soup_set_header_rules(lua_State *L)
+{
+    LuakitHeaderRules *hr = soupconf.headers;
+    GHashTable *domains;
+    GPtrArray *rules;
+    header_rule_t *r;
+    const gchar *domain, *name;
+    gchar *key;
+
+    luaH_checktable(L, 1);
+
+    domains = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+            (GDestroyNotify) header_rules_free);
+
+    /* iterate over domains */
+    lua_pushnil(L);
+    while (lua_next(L, 1)) {
+        if (lua_type(L, -2) != LUA_TSTRING || !lua_istable(L, -1)) {
+            g_hash_table_destroy(domains);
+            return luaL_error(L, "invalid header rule, expected domain "
+                    "string and headers table, got %s and %s",
+                    lua_typename(L, lua_type(L, -2)),
+                    lua_typename(L, lua_type(L, -1)));
+        }
+
+        /* ".example.com" is the same as "example.com" */
+        domain = lua_tostring(L, -2);
+        while (*domain == '.')
+            domain++;
+
+        /* domains are matched case insensitively */
+        key = g_ascii_strdown(domain, -1);
+        if (!(rules = g_hash_table_lookup(domains, key))) {
+            rules = g_ptr_array_new();
+            g_hash_table_insert(domains, key, rules);
+        } else
+            g_free(key);
+
+        /* iterate over headers */
+        lua_pushnil(L);
+        while (lua_next(L, -2)) {
+            if (lua_type(L, -2) != LUA_TSTRING || (lua_type(L, -1) != LUA_TSTRING
+                    && !(lua_isboolean(L, -1) && !lua_toboolean(L, -1)))) {
+                g_hash_table_destroy(domains);
+                return luaL_error(L, "invalid header rule for %s, expected "
+                        "header name and string value or false", domain);
+            }
+
+            name = lua_tostring(L, -2);
+            r = g_new(header_rule_t, 1);
+            r->name = g_strdup(name);
+            r->value = lua_isboolean(L, -1) ? NULL : g_strdup(lua_tostring(L, -1));
+            g_ptr_array_add(rules, r);
+            lua_pop(L, 1);
+        }
+
+        lua_pop(L, 1);
+    }
+
+    g_hash_table_destroy(hr->domains);
+    hr->domains = domains;
+    return 0;
+}
+
+static void
+finalize(GObject *object)
+{
+    g_hash_table_destroy(LUAKIT_HEADER_RULES(object)->domains);
+    G_OBJECT_CLASS(luakit_header_rules_parent_class)->finalize(object);
+}
+
+static void
+luakit_header_rules_class_init(LuakitHeaderRulesClass *klass)
+{
+    G_OBJECT_CLASS(klass)->finalize = finalize;
+}
+
+static void
+luakit_header_rules_init(LuakitHeaderRules *hr)
+{
+    hr->domains = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+static void
+luakit_header_rules_session_feature_init(SoupSessionFeatureInterface *interface,
+        gpointer data)
+{
+    (void) data;
+    interface->request_started = request_started;
+}
+
+LuakitHeaderRules *
+luakit_header_rules_new()
+{
+    return g_object_new(LUAKIT_TYPE_HEADER_RULES, NULL);
+}
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
@@ -0,0 +1,49 @@
+/*
+ * clib/soup/headers.h - per-domain request header rules
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LUAKIT_CLIB_SOUP_HEADERS_H
+#define LUAKIT_CLIB_SOUP_HEADERS_H
+
+#include <glib-object.h>
+#include <lua.h>
+
+#define LUAKIT_TYPE_HEADER_RULES            (luakit_header_rules_get_type ())
+#define LUAKIT_HEADER_RULES(object)         (G_TYPE_CHECK_INSTANCE_CAST ((object), LUAKIT_TYPE_HEADER_RULES, LuakitHeaderRules))
+#define LUAKIT_HEADER_RULES_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),     LUAKIT_TYPE_HEADER_RULES, LuakitHeaderRulesClass))
+#define LUAKIT_IS_HEADER_RULES(object)      (G_TYPE_CHECK_INSTANCE_TYPE ((object), LUAKIT_TYPE_HEADER_RULES))
+
+typedef struct {
+    GObject parent_instance;
+    /* rules by domain, each a GPtrArray of header_rule_t */
+    GHashTable *domains;
+} LuakitHeaderRules;
+
+typedef struct {
+    GObjectClass parent_class;
+} LuakitHeaderRulesClass;
+
+GType luakit_header_rules_get_type();
+LuakitHeaderRules *luakit_header_rules_new();
+
+gint luaH_soup_set_header_rules(lua_State *L);
+
+#endif
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
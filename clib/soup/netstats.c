@@ -0,0 +1,374 @@
+/*
+ * clib/soup/netstats.c - per-request network timing instrumentation
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "clib/soup/soup.h"
+#include "clib/soup/netstats.h"
+#include "common/luastats.h"
+#include "common/signal.h"
+#include "globalconf.h"
+#include "luah.h"
+
+#include <gio/gio.h>
+#include <libsoup/soup-message.h>
+#include <libsoup/soup-session-feature.h>
+#include <libsoup/soup-uri.h>
+
+static void luakit_net_stats_session_feature_init(SoupSessionFeatureInterface *interface, gpointer data);
+
+G_DEFINE_TYPE_WITH_CODE(LuakitNetStats, luakit_net_stats, G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE(SOUP_TYPE_SESSION_FEATURE, luakit_net_stats_session_feature_init))
+
+/* per view aggregate, kept on the views widget so it dies with the view */
+typedef struct {
+    netstats_t total;
+    GHashTable *hosts;
+} netstats_view_t;
+
+/* timestamps (in µs from the monotonic clock) of a single request */
+typedef struct {
+    gchar *host;
+    gint64 queued;
+    gint64 resolving;
+    gint64 resolved;
+    gint64 connecting;
+    gint64 connected;
+    gint64 handshaking;
+    gint64 handshaked;
+    gint64 first_byte;
+    goffset bytes;
+} netstats_request_t;
+
+#define NETSTATS_REQUEST_KEY "luakit-netstats-request"
+#define NETSTATS_VIEW_KEY    "luakit-netstats"
+
+static netstats_t*
+netstats_lookup(GHashTable *hosts, const gchar *host)
+{
+    netstats_t *s = g_hash_table_lookup(hosts, host);
+    if (!s) {
+        s = g_new0(netstats_t, 1);
+        g_hash_table_insert(hosts, g_strdup(host), s);
+    }
+    return s;
+}
+
+static void
+netstats_view_free(netstats_view_t *vs)
+{
+    g_hash_table_destroy(vs->hosts);
+    g_free(vs);
+}
+
+static netstats_view_t*
+netstats_view_get(widget_t *w, gboolean create)
+{
+    if (!w || !w->widget)
+        return NULL;
+
+    netstats_view_t *vs = g_object_get_data(G_OBJECT(w->widget), NETSTATS_VIEW_KEY);
+    if (!vs && create) {
+        vs = g_new0(netstats_view_t, 1);
+        vs->hosts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        g_object_set_data_full(G_OBJECT(w->widget), NETSTATS_VIEW_KEY, vs,
+                (GDestroyNotify) netstats_view_free);
+    }
+    return vs;
+}
+
+static void
+netstats_add(netstats_t *s, netstats_request_t *r, gint64 now, gboolean failed)
+{
+    s->requests++;
+    s->bytes += r->bytes;
+    if (failed)
+        s->failed++;
+
+    /* reused connections skip the dns, connect & tls phases */
+    if (r->resolving && r->resolved)
+        histogram_add(&s->dns, ELAPSED_MS(r->resolving, r->resolved));
+    if (r->connecting && r->connected)
+        histogram_add(&s->connect, ELAPSED_MS(r->connecting, r->connected));
+    if (r->handshaking && r->handshaked)
+        histogram_add(&s->tls, ELAPSED_MS(r->handshaking, r->handshaked));
+    if (r->first_byte)
+        histogram_add(&s->ttfb, ELAPSED_MS(r->queued, r->first_byte));
+    histogram_add(&s->total, ELAPSED_MS(r->queued, now));
+}
+
+static gint
+luaH_netstats_push(lua_State *L, netstats_t *s)
+{
+    lua_createtable(L, 0, 8);
+
+#define PUSH_HIST(name)                  \
+    lua_pushliteral(L, #name);           \
+    luaH_histogram_push(L, &s->name);    \
+    lua_rawset(L, -3);
+
+    luaH_pushnumfield(L, "requests", s->requests);
+    luaH_pushnumfield(L, "failed",   s->failed);
+    luaH_pushnumfield(L, "bytes",    s->bytes);
+    PUSH_HIST(dns)
+    PUSH_HIST(connect)
+    PUSH_HIST(tls)
+    PUSH_HIST(ttfb)
+    PUSH_HIST(total)
+
+#undef PUSH_HIST
+
+    return 1;
+}
+
+static gint
+luaH_netstats_push_hosts(lua_State *L, GHashTable *hosts)
+{
+    GHashTableIter iter;
+    gpointer host, s;
+
+    lua_createtable(L, 0, g_hash_table_size(hosts));
+    g_hash_table_iter_init(&iter, hosts);
+    while (g_hash_table_iter_next(&iter, &host, &s)) {
+        lua_pushstring(L, host);
+        luaH_netstats_push(L, s);
+        lua_rawset(L, -3);
+    }
+    return 1;
+}
+
+/* Returns the aggregate of all requests made by the view or NULL if the view
+ * hasn't made any requests yet */
+netstats_t*
+netstats_view_total(widget_t *w)
+{
+    netstats_view_t *vs = netstats_view_get(w, FALSE);
+    return vs ? &vs->total : NULL;
+}
+
+/* Pushes the network statistics of the given view, the table holds the
+ * aggregate of all requests made by the view and a `hosts` table with the
+ * aggregates of each remote host. */
+gint
+luaH_netstats_push_view(lua_State *L, widget_t *w)
+{
+    netstats_view_t *vs = netstats_view_get(w, TRUE);
+
+    /* destroyed views have nothing to show */
+    if (!vs) {
+        lua_createtable(L, 0, 1);
+        lua_pushliteral(L, "hosts");
+        lua_newtable(L);
+        lua_rawset(L, -3);
+        return 1;
+    }
+
+    luaH_netstats_push(L, &vs->total);
+    lua_pushliteral(L, "hosts");
+    luaH_netstats_push_hosts(L, vs->hosts);
+    lua_rawset(L, -3);
+    return 1;
+}
+
+/* Pushes the network statistics of all requests made through the session
+ * by remote host. */
+gint
+luaH_soup_network_stats(lua_State *L)
+{
+    return luaH_netstats_push_hosts(L, soupconf.netstats->hosts);
+}
+
+static gint
+luaH_netstats_push_request(lua_State *L, netstats_request_t *r,
+        SoupMessage *msg, gint64 now)
+{
+    lua_createtable(L, 0, 9);
+
+    lua_pushliteral(L, "host");
+    lua_pushstring(L, r->host);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "status");
+    lua_pushnumber(L, msg->status_code);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "bytes");
+    lua_pushnumber(L, r->bytes);
+    lua_rawset(L, -3);
+
+    luaH_pushelapsedfield(L, "dns",     r->resolving,   r->resolved);
+    luaH_pushelapsedfield(L, "connect", r->connecting,  r->connected);
+    luaH_pushelapsedfield(L, "tls",     r->handshaking, r->handshaked);
+    luaH_pushelapsedfield(L, "ttfb",    r->queued,      r->first_byte);
+    luaH_pushnumfield(L, "total", ELAPSED_MS(r->queued, now));
+
+    return 1;
+}
+
+static void
+network_event_cb(SoupMessage *msg, GSocketClientEvent event,
+        GIOStream *connection, netstats_request_t *r)
+{
+    (void) msg;
+    (void) connection;
+    gint64 now = g_get_monotonic_time();
+
+    switch (event) {
+#define NE_CASE(a, field) case G_SOCKET_CLIENT_##a: r->field = now; break;
+        NE_CASE(RESOLVING,      resolving)
+        NE_CASE(RESOLVED,       resolved)
+        NE_CASE(CONNECTING,     connecting)
+        NE_CASE(CONNECTED,      connected)
+        NE_CASE(TLS_HANDSHAKING, handshaking)
+        NE_CASE(TLS_HANDSHAKED, handshaked)
+#undef  NE_CASE
+      default:
+        break;
+    }
+}
+
+static void
+got_headers_cb(SoupMessage *msg, netstats_request_t *r)
+{
+    (void) msg;
+    if (!r->first_byte)
+        r->first_byte = g_get_monotonic_time();
+}
+
+static void
+got_chunk_cb(SoupMessage *msg, SoupBuffer *chunk, netstats_request_t *r)
+{
+    (void) msg;
+    r->bytes += chunk->length;
+}
+
+static void
+netstats_request_free(netstats_request_t *r)
+{
+    g_free(r->host);
+    g_free(r);
+}
+
+static void
+request_queued(SoupSessionFeature *feature, SoupSession *session,
+        SoupMessage *msg)
+{
+    (void) feature;
+    (void) session;
+    SoupURI *uri = soup_message_get_uri(msg);
+
+    netstats_request_t *r = g_new0(netstats_request_t, 1);
+    r->queued = g_get_monotonic_time();
+    r->host = g_strdup(uri && uri->host ? uri->host : "");
+    /* claim the view now, before another request for the same uri can */
+    soup_message_get_view(msg);
+    g_object_set_data_full(G_OBJECT(msg), NETSTATS_REQUEST_KEY, r,
+            (GDestroyNotify) netstats_request_free);
+
+    g_object_connect(G_OBJECT(msg),
+      "signal::network-event", G_CALLBACK(network_event_cb), r,
+      "signal::got-headers",   G_CALLBACK(got_headers_cb),   r,
+      "signal::got-chunk",     G_CALLBACK(got_chunk_cb),     r,
+      NULL);
+}
+
+static void
+request_unqueued(SoupSessionFeature *feature, SoupSession *session,
+        SoupMessage *msg)
+{
+    (void) session;
+    LuakitNetStats *ns = LUAKIT_NET_STATS(feature);
+    netstats_request_t *r = g_object_get_data(G_OBJECT(msg), NETSTATS_REQUEST_KEY);
+    if (!r)
+        return;
+
+    gint64 now = g_get_monotonic_time();
+    gboolean failed = SOUP_STATUS_IS_TRANSPORT_ERROR(msg->status_code);
+    g_signal_handlers_disconnect_matched(msg, G_SIGNAL_MATCH_DATA,
+            0, 0, NULL, NULL, r);
+
+    /* streamed responses never emit "got-chunk" so fall back to the length
+     * announced by the server */
+    if (!r->bytes && msg->response_headers) {
+        goffset len = soup_message_headers_get_content_length(msg->response_headers);
+        if (len > 0)
+            r->bytes = len;
+    }
+
+    /* the view might have been destroyed while the request was running */
+    widget_t *w = soup_message_get_view(msg);
+
+    netstats_add(netstats_lookup(ns->hosts, r->host), r, now, failed);
+    netstats_view_t *vs = netstats_view_get(w, TRUE);
+    if (vs) {
+        netstats_add(&vs->total, r, now, failed);
+        netstats_add(netstats_lookup(vs->hosts, r->host), r, now, failed);
+    }
+
+    /* only build the timing table if anyone is listening */
+    if (signal_lookup(soup_class.signals, "request-finished")) {
+        lua_State *L = globalconf.L;
+        gchar *uri = soup_uri_to_string(soup_message_get_uri(msg), FALSE);
+        lua_pushstring(L, uri);
+        g_free(uri);
+        luaH_netstats_push_request(L, r, msg, now);
+        if (w)
+            luaH_object_push(L, w->ref);
+        else
+            lua_pushnil(L);
+        signal_object_emit(L, soup_class.signals, "request-finished", 3, 0);
+    }
+
+    g_object_set_data(G_OBJECT(msg), NETSTATS_REQUEST_KEY, NULL);
+}
+
+static void
+finalize(GObject *object)
+{
+    g_hash_table_destroy(LUAKIT_NET_STATS(object)->hosts);
+    G_OBJECT_CLASS(luakit_net_stats_parent_class)->finalize(object);
+}
+
+static void
+luakit_net_stats_class_init(LuakitNetStatsClass *klass)
+{
+    G_OBJECT_CLASS(klass)->finalize = finalize;
+}
+
+static void
+luakit_net_stats_init(LuakitNetStats *ns)
+{
+    ns->hosts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+}
+
+static void
+luakit_net_stats_session_feature_init(SoupSessionFeatureInterface *interface,
+        gpointer data)
+{
+    (void) data;
+    interface->request_queued = request_queued;
+    interface->request_unqueued = request_unqueued;
+}
+
+LuakitNetStats *
+luakit_net_stats_new()
+{
+    return g_object_new(LUAKIT_TYPE_NET_STATS, NULL);
+}
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
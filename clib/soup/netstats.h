@@ -0,0 +1,65 @@
+/*
+ * clib/soup/netstats.h - per-request network timing instrumentation
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LUAKIT_CLIB_SOUP_NETSTATS_H
+#define LUAKIT_CLIB_SOUP_NETSTATS_H
+
+#include "clib/widget.h"
+#include "common/histogram.h"
+
+#include <glib-object.h>
+
+#define LUAKIT_TYPE_NET_STATS            (luakit_net_stats_get_type ())
+#define LUAKIT_NET_STATS(object)         (G_TYPE_CHECK_INSTANCE_CAST ((object), LUAKIT_TYPE_NET_STATS, LuakitNetStats))
+#define LUAKIT_NET_STATS_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),     LUAKIT_TYPE_NET_STATS, LuakitNetStatsClass))
+#define LUAKIT_IS_NET_STATS(object)      (G_TYPE_CHECK_INSTANCE_TYPE ((object), LUAKIT_TYPE_NET_STATS))
+
+/* aggregated timings of a group of requests (all times in ms) */
+typedef struct {
+    guint requests;
+    guint failed;
+    guint64 bytes;
+    histogram_t dns;
+    histogram_t connect;
+    histogram_t tls;
+    histogram_t ttfb;
+    histogram_t total;
+} netstats_t;
+
+typedef struct {
+    GObject parent_instance;
+    /* netstats_t of all requests by hostname */
+    GHashTable *hosts;
+} LuakitNetStats;
+
+typedef struct {
+    GObjectClass parent_class;
+} LuakitNetStatsClass;
+
+GType luakit_net_stats_get_type();
+LuakitNetStats *luakit_net_stats_new();
+
+netstats_t *netstats_view_total(widget_t *w);
+gint luaH_netstats_push_view(lua_State *L, widget_t *w);
+gint luaH_soup_network_stats(lua_State *L);
+
+#endif
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
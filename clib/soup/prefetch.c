@@ -0,0 +1,261 @@
+/*
+ * clib/soup/prefetch.c - speculative dns prefetch & preconnect
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "clib/soup/soup.h"
+#include "clib/soup/prefetch.h"
+#include "common/luastats.h"
+#include "luah.h"
+
+#include <gio/gio.h>
+#include <libsoup/soup-session.h>
+#include <libsoup/soup-uri.h>
+
+/* a recently warmed host */
+typedef struct {
+    gchar *host;
+    /* monotonic time of the last prefetch */
+    gint64 warmed;
+    /* TRUE if a connection was opened, not only the address resolved */
+    gboolean connected;
+    /* link in the lru queue */
+    GList *link;
+} prefetch_host_t;
+
+static struct {
+    gboolean enabled;
+    gboolean preconnect;
+    /* token bucket refill rate (prefetches per second) & size */
+    gdouble rate;
+    gdouble burst;
+    /* size of the warmed hosts lru */
+    guint max_hosts;
+    /* time (in µs) before a warmed host is prefetched again */
+    gint64 ttl;
+
+    gdouble tokens;
+    gint64 refilled;
+    GHashTable *hosts;
+    GQueue lru;
+
+    struct {
+        guint dns;
+        guint preconnect;
+        guint deduped;
+        guint limited;
+    } stats;
+} prefetch = {
+    .enabled    = TRUE,
+    .preconnect = FALSE,
+    .rate       = 4,
+    .burst      = 8,
+    .max_hosts  = 256,
+    .ttl        = 60 * G_USEC_PER_SEC,
+    .tokens     = 8,
+};
+
+static void
+prefetch_host_free(prefetch_host_t *h)
+{
+    g_free(h->host);
+    g_free(h);
+}
+
+static void
+prefetch_trim(guint max)
+{
+    prefetch_host_t *h;
+    while (g_queue_get_length(&prefetch.lru) > max) {
+        h = g_queue_pop_tail(&prefetch.lru);
+        g_hash_table_remove(prefetch.hosts, h->host);
+    }
+}
+
+/* take a token from the bucket, returns FALSE if the bucket is empty */
+static gboolean
+prefetch_take_token(gint64 now)
+{
+    if (prefetch.refilled)
+        prefetch.tokens += prefetch.rate * (now - prefetch.refilled)
+            / G_USEC_PER_SEC;
+    prefetch.refilled = now;
+
+    if (prefetch.tokens > prefetch.burst)
+        prefetch.tokens = prefetch.burst;
+
+    if (prefetch.tokens < 1)
+        return FALSE;
+
+    prefetch.tokens--;
+    return TRUE;
+}
+
+static void
+resolved_cb(GObject *resolver, GAsyncResult *res, gpointer data)
+{
+    (void) data;
+    GError *err = NULL;
+    GList *addrs = g_resolver_lookup_by_name_finish(G_RESOLVER(resolver),
+            res, &err);
+
+    /* only the side effect of warming the resolver cache matters */
+    if (err) {
+        debug("prefetch failed: %s", err->message);
+        g_error_free(err);
+    } else
+        g_resolver_free_addresses(addrs);
+}
+
+/* Resolves the host of the given uri and, if preconnecting is enabled and
+ * requested, asks the session to open a connection to it. Returns TRUE if
+ * a prefetch was started. */
+gboolean
+soup_prefetch_uri(const gchar *str, gboolean preconnect)
+{
+    if (!prefetch.enabled || !str)
+        return FALSE;
+
+    SoupURI *uri;
+    /* default to http:// scheme */
+    if (!g_strrstr(str, "://")) {
+        gchar *tmp = g_strdup_printf("http://%s", str);
+        uri = soup_uri_new(tmp);
+        g_free(tmp);
+    } else
+        uri = soup_uri_new(str);
+
+    if (!uri)
+        return FALSE;
+
+    if (!uri->host || !uri->host[0] || (uri->scheme != SOUP_URI_SCHEME_HTTP
+                && uri->scheme != SOUP_URI_SCHEME_HTTPS)) {
+        soup_uri_free(uri);
+        return FALSE;
+    }
+
+    preconnect = preconnect && prefetch.preconnect;
+
+    if (!prefetch.hosts)
+        prefetch.hosts = g_hash_table_new_full(g_str_hash, g_str_equal,
+                NULL, (GDestroyNotify) prefetch_host_free);
+
+    gint64 now = g_get_monotonic_time();
+    prefetch_host_t *h = g_hash_table_lookup(prefetch.hosts, uri->host);
+
+    /* host still warm */
+    if (h && now - h->warmed < prefetch.ttl && (h->connected || !preconnect)) {
+        g_queue_unlink(&prefetch.lru, h->link);
+        g_queue_push_head_link(&prefetch.lru, h->link);
+        prefetch.stats.deduped++;
+        soup_uri_free(uri);
+        return FALSE;
+    }
+
+    if (!prefetch_take_token(now)) {
+        prefetch.stats.limited++;
+        soup_uri_free(uri);
+        return FALSE;
+    }
+
+    if (!h) {
+        h = g_new0(prefetch_host_t, 1);
+        h->host = g_strdup(uri->host);
+        g_queue_push_head(&prefetch.lru, h);
+        h->link = prefetch.lru.head;
+        g_hash_table_insert(prefetch.hosts, h->host, h);
+    } else {
+        g_queue_unlink(&prefetch.lru, h->link);
+        g_queue_push_head_link(&prefetch.lru, h->link);
+        if (now - h->warmed >= prefetch.ttl)
+            h->connected = FALSE;
+    }
+    h->warmed = now;
+
+    if (preconnect) {
+        /* resolves the address through the session's own cache too */
+        soup_session_prepare_for_uri(soupconf.session, uri);
+        h->connected = TRUE;
+        prefetch.stats.preconnect++;
+    } else if (!g_hostname_is_ip_address(uri->host)) {
+        g_resolver_lookup_by_name_async(g_resolver_get_default(), uri->host,
+                NULL, resolved_cb, NULL);
+        prefetch.stats.dns++;
+    }
+
+    prefetch_trim(prefetch.max_hosts);
+    soup_uri_free(uri);
+    return TRUE;
+}
+
+gint
+luaH_soup_prefetch(lua_State *L)
+{
+    const gchar *uri = luaL_checkstring(L, 1);
+    gboolean preconnect = luaH_optboolean(L, 2, TRUE);
+    lua_pushboolean(L, soup_prefetch_uri(uri, preconnect));
+    return 1;
+}
+
+/* Updates the prefetch settings from the given table, all fields are
+ * optional:
+ *   enabled    - master switch (default true)
+ *   preconnect - allow opening connections, not only dns lookups
+ *   rate       - prefetches per second allowed on average
+ *   burst      - prefetches allowed in a single burst
+ *   max_hosts  - number of warmed hosts remembered
+ *   ttl        - seconds before a warmed host is prefetched again */
+gint
+luaH_soup_set_prefetch(lua_State *L)
+{
+    luaH_checktable(L, 1);
+
+    prefetch.enabled = luaH_getopt_boolean(L, 1, "enabled", prefetch.enabled);
+    prefetch.preconnect = luaH_getopt_boolean(L, 1, "preconnect",
+            prefetch.preconnect);
+    prefetch.rate = MAX(0, luaH_getopt_number(L, 1, "rate", prefetch.rate));
+    prefetch.burst = MAX(1, luaH_getopt_number(L, 1, "burst", prefetch.burst));
+    prefetch.max_hosts = MAX(1, luaH_getopt_number(L, 1, "max_hosts",
+                prefetch.max_hosts));
+    prefetch.ttl = MAX(0, luaH_getopt_number(L, 1, "ttl",
+                (gdouble) prefetch.ttl / G_USEC_PER_SEC)) * G_USEC_PER_SEC;
+
+    if (prefetch.tokens > prefetch.burst)
+        prefetch.tokens = prefetch.burst;
+
+    if (prefetch.hosts)
+        prefetch_trim(prefetch.enabled ? prefetch.max_hosts : 0);
+
+    return 0;
+}
+
+gint
+luaH_soup_prefetch_stats(lua_State *L)
+{
+    lua_createtable(L, 0, 5);
+
+    luaH_pushnumfield(L, "dns",        prefetch.stats.dns);
+    luaH_pushnumfield(L, "preconnect", prefetch.stats.preconnect);
+    luaH_pushnumfield(L, "deduped",    prefetch.stats.deduped);
+    luaH_pushnumfield(L, "limited",    prefetch.stats.limited);
+    luaH_pushnumfield(L, "hosts",      g_queue_get_length(&prefetch.lru));
+
+    return 1;
+}
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
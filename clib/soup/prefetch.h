@@ -0,0 +1,34 @@
+/*
+ * clib/soup/prefetch.h - speculative dns prefetch & preconnect
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LUAKIT_CLIB_SOUP_PREFETCH_H
+#define LUAKIT_CLIB_SOUP_PREFETCH_H
+
+#include <glib.h>
+#include <lua.h>
+
+gboolean soup_prefetch_uri(const gchar *uri, gboolean preconnect);
+gint luaH_soup_prefetch(lua_State *L);
+gint luaH_soup_set_prefetch(lua_State *L);
+gint luaH_soup_prefetch_stats(lua_State *L);
+
+#endif
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
@@ -0,0 +1,615 @@
+/*
+ * clib/soup/resolver.c - caching dns resolver
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "clib/soup/soup.h"
+#include "clib/soup/resolver.h"
+#include "common/luastats.h"
+#include "luah.h"
+
+G_DEFINE_TYPE(LuakitResolver, luakit_resolver, G_TYPE_RESOLVER)
+
+/* lookups might come from other threads (i.e. sync soup sessions) */
+G_LOCK_DEFINE_STATIC(resolver);
+
+typedef struct {
+    gchar *hostname;
+    /* list of GInetAddress or NULL for a cached failure */
+    GList *addrs;
+    gint64 expires;
+    GList *link;
+} cache_entry_t;
+
+typedef struct {
+    LuakitResolver *resolver;
+    gchar *hostname;
+    gint64 started;
+} lookup_t;
+
+static GList*
+copy_addresses(GList *addrs)
+{
+    GList *copy = NULL;
+    for (GList *a = addrs; a; a = g_list_next(a))
+        copy = g_list_prepend(copy, g_object_ref(a->data));
+    return g_list_reverse(copy);
+}
+
+static void
+cache_entry_free(cache_entry_t *e)
+{
+    if (e->addrs)
+        g_resolver_free_addresses(e->addrs);
+    g_free(e->hostname);
+    g_free(e);
+}
+
+static void
+cache_trim(LuakitResolver *r, guint max)
+{
+    cache_entry_t *e;
+    while (g_queue_get_length(&r->lru) > max) {
+        e = g_queue_pop_tail(&r->lru);
+        g_hash_table_remove(r->cache, e->hostname);
+    }
+}
+
+/* Returns the unexpired cache entry of the hostname (and bumps it in the
+ * lru) or NULL. Must be called with the lock held. */
+static cache_entry_t*
+cache_lookup(LuakitResolver *r, const gchar *hostname)
+{
+    cache_entry_t *e = g_hash_table_lookup(r->cache, hostname);
+    if (!e)
+        return NULL;
+
+    if (e->expires <= g_get_monotonic_time()) {
+        g_queue_delete_link(&r->lru, e->link);
+        g_hash_table_remove(r->cache, hostname);
+        return NULL;
+    }
+
+    g_queue_unlink(&r->lru, e->link);
+    g_queue_push_head_link(&r->lru, e->link);
+
+    if (e->addrs)
+        r->stats.hits++;
+    else
+        r->stats.negative_hits++;
+    return e;
+}
+
+/* Records the outcome of a lookup, only "not found" failures are cached as
+ * temporary failures are likely to go away on retry. Must be called with the
+ * lock held. */
+static void
+cache_insert(LuakitResolver *r, const gchar *hostname, GList *addrs,
+        GError *err, gint64 started)
+{
+    gint64 now = g_get_monotonic_time(), ttl;
+
+    r->stats.lookups++;
+    r->stats.lookup_time += ELAPSED_MS(started, now);
+
+    if (err && !g_error_matches(err, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND))
+        return;
+
+    if (!(ttl = addrs ? r->ttl : r->negative_ttl))
+        return;
+
+    cache_entry_t *e = g_hash_table_lookup(r->cache, hostname);
+    if (e) {
+        g_queue_delete_link(&r->lru, e->link);
+        g_hash_table_remove(r->cache, hostname);
+    }
+
+    e = g_new0(cache_entry_t, 1);
+    e->hostname = g_strdup(hostname);
+    e->addrs = copy_addresses(addrs);
+    e->expires = now + ttl;
+    g_queue_push_head(&r->lru, e);
+    e->link = r->lru.head;
+    g_hash_table_insert(r->cache, e->hostname, e);
+
+    cache_trim(r, r->max_entries);
+}
+
+static void
+set_not_found(GError **error, const gchar *hostname)
+{
+    g_set_error(error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND,
+            "Error resolving '%s': cached failure", hostname);
+}
+
+static GList*
+lookup_by_name(GResolver *resolver, const gchar *hostname,
+        GCancellable *cancellable, GError **error)
+{
+    LuakitResolver *r = LUAKIT_RESOLVER(resolver);
+    cache_entry_t *e;
+    GList *addrs = NULL;
+    GError *err = NULL;
+
+    G_LOCK(resolver);
+    if ((e = cache_lookup(r, hostname))) {
+        if (e->addrs)
+            addrs = copy_addresses(e->addrs);
+        else
+            set_not_found(error, hostname);
+        G_UNLOCK(resolver);
+        return addrs;
+    }
+    r->stats.misses++;
+    G_UNLOCK(resolver);
+
+    gint64 started = g_get_monotonic_time();
+    addrs = g_resolver_lookup_by_name(r->wrapped, hostname, cancellable, &err);
+
+    G_LOCK(resolver);
+    cache_insert(r, hostname, addrs, err, started);
+    G_UNLOCK(resolver);
+
+    if (err)
+        g_propagate_error(error, err);
+    return addrs;
+}
+
+/* GSimpleAsyncResult is deprecated in favour of GTask (GLib 2.36) */
+#if GLIB_CHECK_VERSION(2,36,0)
+#define RESOLVER_USE_GTASK
+#endif
+
+static void lookup_by_name_async(GResolver *resolver, const gchar *hostname,
+        GCancellable *cancellable, GAsyncReadyCallback callback,
+        gpointer user_data);
+
+/* An async lookup waiting for the (shared) lookup of its hostname. It is
+ * owned by whoever takes it off the pending list: the shared lookup when it
+ * finishes or the cancelled handler. The cancelled handler holds a second
+ * reference until it is disconnected. */
+typedef struct {
+    gint refs;
+#ifdef RESOLVER_USE_GTASK
+    GTask *task;
+#else
+    GSimpleAsyncResult *res;
+#endif
+    LuakitResolver *resolver;
+    gchar *hostname;
+    GCancellable *cancellable;
+    gulong cancelled_id;
+} waiter_t;
+
+static waiter_t*
+waiter_new(GResolver *resolver, const gchar *hostname,
+        GCancellable *cancellable, GAsyncReadyCallback callback,
+        gpointer user_data)
+{
+    waiter_t *w = g_new0(waiter_t, 1);
+    w->refs = 1;
+#ifdef RESOLVER_USE_GTASK
+    w->task = g_task_new(resolver, cancellable, callback, user_data);
+    g_task_set_source_tag(w->task, lookup_by_name_async);
+#else
+    w->res = g_simple_async_result_new(G_OBJECT(resolver), callback,
+            user_data, lookup_by_name_async);
+#endif
+    w->resolver = LUAKIT_RESOLVER(resolver);
+    w->hostname = g_strdup(hostname);
+    w->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+    return w;
+}
+
+static void
+waiter_unref(waiter_t *w)
+{
+    if (!g_atomic_int_dec_and_test(&w->refs))
+        return;
+    if (w->cancellable)
+        g_object_unref(w->cancellable);
+    g_free(w->hostname);
+    g_free(w);
+}
+
+static void waiter_cancelled_cb(GCancellable *cancellable, waiter_t *w);
+
+/* Connects the cancelled handler, must be done before the waiter is put on
+ * the pending list (i.e. seen by other threads) */
+static void
+waiter_connect(waiter_t *w)
+{
+    if (!w->cancellable)
+        return;
+    g_atomic_int_inc(&w->refs);
+    /* runs the handler right away (and returns 0) if already cancelled */
+    w->cancelled_id = g_cancellable_connect(w->cancellable,
+            G_CALLBACK(waiter_cancelled_cb), w,
+            (GDestroyNotify) waiter_unref);
+}
+
+/* Answers the waiter in the context it was started in (with a cancelled
+ * error if it was cancelled) and drops the reference of its owner. */
+static void
+waiter_complete(waiter_t *w, GList *addrs, GError *err)
+{
+    GError *cancelled = NULL;
+    if (g_cancellable_set_error_if_cancelled(w->cancellable, &cancelled))
+        err = cancelled;
+
+    /* waits for a cancelled handler running in another thread, which then
+     * won't find the waiter on the pending list */
+    if (w->cancelled_id) {
+        g_cancellable_disconnect(w->cancellable, w->cancelled_id);
+        w->cancelled_id = 0;
+    }
+
+#ifdef RESOLVER_USE_GTASK
+    if (err)
+        g_task_return_error(w->task, g_error_copy(err));
+    else
+        g_task_return_pointer(w->task, copy_addresses(addrs),
+                (GDestroyNotify) g_resolver_free_addresses);
+    g_object_unref(w->task);
+#else
+    if (err)
+        g_simple_async_result_set_from_error(w->res, err);
+    else
+        g_simple_async_result_set_op_res_gpointer(w->res,
+                copy_addresses(addrs),
+                (GDestroyNotify) g_resolver_free_addresses);
+    /* the shared lookup may finish in another context */
+    g_simple_async_result_complete_in_idle(w->res);
+    g_object_unref(w->res);
+#endif
+    if (cancelled)
+        g_error_free(cancelled);
+    waiter_unref(w);
+}
+
+/* Takes the waiter off the pending list of its hostname, returns FALSE if
+ * it isn't there (anymore). Must be called with the lock held. */
+static gboolean
+waiter_take(waiter_t *w)
+{
+    GSList *waiting = g_hash_table_lookup(w->resolver->pending, w->hostname);
+    if (!g_slist_find(waiting, w))
+        return FALSE;
+    g_hash_table_replace(w->resolver->pending, g_strdup(w->hostname),
+            g_slist_remove(waiting, w));
+    return TRUE;
+}
+
+/* Might run in any thread (the one cancelling) */
+static void
+waiter_cancelled_cb(GCancellable *cancellable, waiter_t *w)
+{
+    (void) cancellable;
+    G_LOCK(resolver);
+    gboolean taken = waiter_take(w);
+    G_UNLOCK(resolver);
+
+    /* the handler can't disconnect itself, its reference is dropped when
+     * the cancellable goes away */
+    if (taken) {
+        w->cancelled_id = 0;
+        waiter_complete(w, NULL, NULL);
+    }
+}
+
+static void
+wrapped_lookup_cb(GObject *source, GAsyncResult *result, lookup_t *l)
+{
+    LuakitResolver *r = l->resolver;
+    GError *err = NULL;
+    GList *addrs = g_resolver_lookup_by_name_finish(G_RESOLVER(source),
+            result, &err);
+
+    G_LOCK(resolver);
+    cache_insert(r, l->hostname, addrs, err, l->started);
+    GSList *waiting = g_hash_table_lookup(r->pending, l->hostname);
+    g_hash_table_remove(r->pending, l->hostname);
+    G_UNLOCK(resolver);
+
+    /* answer everyone who asked for this hostname in the meantime (and
+     * didn't cancel) */
+    waiting = g_slist_reverse(waiting);
+    for (GSList *i = waiting; i; i = g_slist_next(i))
+        waiter_complete(i->data, addrs, err);
+    g_slist_free(waiting);
+
+    if (addrs)
+        g_resolver_free_addresses(addrs);
+    if (err)
+        g_error_free(err);
+    g_object_unref(l->resolver);
+    g_free(l->hostname);
+    g_free(l);
+}
+
+/* Concurrent lookups of the same hostname share a single lookup of the
+ * wrapped resolver, which is why the cancellables are not passed down. A
+ * cancelled lookup is answered right away, the shared lookup keeps going
+ * for the others (and the cache). */
+static void
+lookup_by_name_async(GResolver *resolver, const gchar *hostname,
+        GCancellable *cancellable, GAsyncReadyCallback callback,
+        gpointer user_data)
+{
+    LuakitResolver *r = LUAKIT_RESOLVER(resolver);
+    waiter_t *w = waiter_new(resolver, hostname, cancellable, callback,
+            user_data);
+    cache_entry_t *e;
+    GSList *waiting = NULL;
+
+    waiter_connect(w);
+    if (g_cancellable_is_cancelled(cancellable)) {
+        waiter_complete(w, NULL, NULL);
+        return;
+    }
+
+    G_LOCK(resolver);
+    if ((e = cache_lookup(r, hostname))) {
+        GList *addrs = copy_addresses(e->addrs);
+        G_UNLOCK(resolver);
+
+        if (addrs) {
+            waiter_complete(w, addrs, NULL);
+            g_resolver_free_addresses(addrs);
+        } else {
+            GError *err = NULL;
+            set_not_found(&err, hostname);
+            waiter_complete(w, NULL, err);
+            g_error_free(err);
+        }
+        return;
+    }
+
+    r->stats.misses++;
+
+    /* lookup already in progress (its waiters might all have cancelled) */
+    gboolean start = !g_hash_table_lookup_extended(r->pending, hostname, NULL,
+            (gpointer*) &waiting);
+    g_hash_table_replace(r->pending, g_strdup(hostname),
+            g_slist_prepend(waiting, w));
+    G_UNLOCK(resolver);
+
+    if (!start)
+        return;
+
+    lookup_t *l = g_new(lookup_t, 1);
+    l->resolver = g_object_ref(r);
+    l->hostname = g_strdup(hostname);
+    l->started = g_get_monotonic_time();
+    g_resolver_lookup_by_name_async(r->wrapped, hostname, NULL,
+            (GAsyncReadyCallback) wrapped_lookup_cb, l);
+}
+
+static GList*
+lookup_by_name_finish(GResolver *resolver, GAsyncResult *result,
+        GError **error)
+{
+#ifdef RESOLVER_USE_GTASK
+    g_return_val_if_fail(g_task_is_valid(result, resolver), NULL);
+    return g_task_propagate_pointer(G_TASK(result), error);
+#else
+    GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT(result);
+    g_return_val_if_fail(g_simple_async_result_is_valid(result,
+                G_OBJECT(resolver), lookup_by_name_async), NULL);
+
+    if (g_simple_async_result_propagate_error(res, error))
+        return NULL;
+
+    return copy_addresses(g_simple_async_result_get_op_res_gpointer(res));
+#endif
+}
+
+/* everything but forward lookups goes straight to the wrapped resolver */
+
+static gchar*
+lookup_by_address(GResolver *resolver, GInetAddress *address,
+        GCancellable *cancellable, GError **error)
+{
+    return g_resolver_lookup_by_address(LUAKIT_RESOLVER(resolver)->wrapped,
+            address, cancellable, error);
+}
+
+static void
+lookup_by_address_async(GResolver *resolver, GInetAddress *address,
+        GCancellable *cancellable, GAsyncReadyCallback callback,
+        gpointer user_data)
+{
+    g_resolver_lookup_by_address_async(LUAKIT_RESOLVER(resolver)->wrapped,
+            address, cancellable, callback, user_data);
+}
+
+static gchar*
+lookup_by_address_finish(GResolver *resolver, GAsyncResult *result,
+        GError **error)
+{
+    return g_resolver_lookup_by_address_finish(
+            LUAKIT_RESOLVER(resolver)->wrapped, result, error);
+}
+
+static GList*
+lookup_service(GResolver *resolver, const gchar *rrname,
+        GCancellable *cancellable, GError **error)
+{
+    GResolver *wrapped = LUAKIT_RESOLVER(resolver)->wrapped;
+    return G_RESOLVER_GET_CLASS(wrapped)->lookup_service(wrapped, rrname,
+            cancellable, error);
+}
+
+static void
+lookup_service_async(GResolver *resolver, const gchar *rrname,
+        GCancellable *cancellable, GAsyncReadyCallback callback,
+        gpointer user_data)
+{
+    GResolver *wrapped = LUAKIT_RESOLVER(resolver)->wrapped;
+    G_RESOLVER_GET_CLASS(wrapped)->lookup_service_async(wrapped, rrname,
+            cancellable, callback, user_data);
+}
+
+static GList*
+lookup_service_finish(GResolver *resolver, GAsyncResult *result,
+        GError **error)
+{
+    return g_resolver_lookup_service_finish(
+            LUAKIT_RESOLVER(resolver)->wrapped, result, error);
+}
+
+#if GLIB_CHECK_VERSION(2,34,0)
+static GList*
+lookup_records(GResolver *resolver, const gchar *rrname,
+        GResolverRecordType record_type, GCancellable *cancellable,
+        GError **error)
+{
+    return g_resolver_lookup_records(LUAKIT_RESOLVER(resolver)->wrapped,
+            rrname, record_type, cancellable, error);
+}
+
+static void
+lookup_records_async(GResolver *resolver, const gchar *rrname,
+        GResolverRecordType record_type, GCancellable *cancellable,
+        GAsyncReadyCallback callback, gpointer user_data)
+{
+    g_resolver_lookup_records_async(LUAKIT_RESOLVER(resolver)->wrapped,
+            rrname, record_type, cancellable, callback, user_data);
+}
+
+static GList*
+lookup_records_finish(GResolver *resolver, GAsyncResult *result,
+        GError **error)
+{
+    return g_resolver_lookup_records_finish(
+            LUAKIT_RESOLVER(resolver)->wrapped, result, error);
+}
+#endif
+
+static void
+reload_cb(GResolver *wrapped, LuakitResolver *r)
+{
+    (void) wrapped;
+    /* resolv.conf changed, forget everything */
+    G_LOCK(resolver);
+    cache_trim(r, 0);
+    G_UNLOCK(resolver);
+}
+
+/* Updates the dns cache settings from the given table:
+ *   ttl          - seconds answers are cached
+ *   negative_ttl - seconds unknown hostnames are cached
+ *   max_entries  - number of cached hostnames
+ * Resolvers don't expose the ttl of the records they return, so answers are
+ * cached for a fixed time instead. */
+gint
+luaH_soup_set_dns_cache(lua_State *L)
+{
+    LuakitResolver *r = soupconf.resolver;
+    luaH_checktable(L, 1);
+
+    G_LOCK(resolver);
+    r->ttl = MAX(0, luaH_getopt_number(L, 1, "ttl",
+                (gdouble) r->ttl / G_USEC_PER_SEC)) * G_USEC_PER_SEC;
+    r->negative_ttl = MAX(0, luaH_getopt_number(L, 1, "negative_ttl",
+                (gdouble) r->negative_ttl / G_USEC_PER_SEC)) * G_USEC_PER_SEC;
+    r->max_entries = MAX(0, luaH_getopt_number(L, 1, "max_entries",
+                r->max_entries));
+    cache_trim(r, r->max_entries);
+    G_UNLOCK(resolver);
+
+    return 0;
+}
+
+gint
+luaH_soup_dns_cache_stats(lua_State *L)
+{
+    LuakitResolver *r = soupconf.resolver;
+    lua_createtable(L, 0, 6);
+
+    G_LOCK(resolver);
+    luaH_pushnumfield(L, "hits",          r->stats.hits);
+    luaH_pushnumfield(L, "negative_hits", r->stats.negative_hits);
+    luaH_pushnumfield(L, "misses",        r->stats.misses);
+    luaH_pushnumfield(L, "entries",       g_queue_get_length(&r->lru));
+    luaH_pushnumfield(L, "lookups",       r->stats.lookups);
+    /* in ms, only lookups which went to the wrapped resolver */
+    luaH_pushnumfield(L, "mean_lookup_time", r->stats.lookups ?
+            r->stats.lookup_time / r->stats.lookups : 0);
+    G_UNLOCK(resolver);
+
+    return 1;
+}
+
+static void
+finalize(GObject *object)
+{
+    LuakitResolver *r = LUAKIT_RESOLVER(object);
+    g_signal_handlers_disconnect_by_func(r->wrapped, reload_cb, r);
+    g_object_unref(r->wrapped);
+    g_hash_table_destroy(r->cache);
+    g_queue_clear(&r->lru);
+    g_hash_table_destroy(r->pending);
+    G_OBJECT_CLASS(luakit_resolver_parent_class)->finalize(object);
+}
+
+static void
+luakit_resolver_class_init(LuakitResolverClass *klass)
+{
+    GResolverClass *resolver_class = G_RESOLVER_CLASS(klass);
+    G_OBJECT_CLASS(klass)->finalize = finalize;
+
+    resolver_class->lookup_by_name           = lookup_by_name;
+    resolver_class->lookup_by_name_async     = lookup_by_name_async;
+    resolver_class->lookup_by_name_finish    = lookup_by_name_finish;
+    resolver_class->lookup_by_address        = lookup_by_address;
+    resolver_class->lookup_by_address_async  = lookup_by_address_async;
+    resolver_class->lookup_by_address_finish = lookup_by_address_finish;
+    resolver_class->lookup_service           = lookup_service;
+    resolver_class->lookup_service_async     = lookup_service_async;
+    resolver_class->lookup_service_finish    = lookup_service_finish;
+#if GLIB_CHECK_VERSION(2,34,0)
+    resolver_class->lookup_records           = lookup_records;
+    resolver_class->lookup_records_async     = lookup_records_async;
+    resolver_class->lookup_records_finish    = lookup_records_finish;
+#endif
+}
+
+static void
+luakit_resolver_init(LuakitResolver *r)
+{
+    r->cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+            (GDestroyNotify) cache_entry_free);
+    r->pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    r->max_entries = 512;
+    r->ttl = 60 * G_USEC_PER_SEC;
+    r->negative_ttl = 10 * G_USEC_PER_SEC;
+}
+
+/* Creates a resolver which caches the forward lookups of the given
+ * resolver, install it with g_resolver_set_default. */
+LuakitResolver *
+luakit_resolver_new(GResolver *wrapped)
+{
+    LuakitResolver *r = g_object_new(LUAKIT_TYPE_RESOLVER, NULL);
+    r->wrapped = g_object_ref(wrapped);
+    g_signal_connect(wrapped, "reload", G_CALLBACK(reload_cb), r);
+    return r;
+}
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
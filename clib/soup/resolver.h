@@ -0,0 +1,68 @@
+/*
+ * clib/soup/resolver.h - caching dns resolver
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LUAKIT_CLIB_SOUP_RESOLVER_H
+#define LUAKIT_CLIB_SOUP_RESOLVER_H
+
+#include <gio/gio.h>
+#include <lua.h>
+
+#define LUAKIT_TYPE_RESOLVER            (luakit_resolver_get_type ())
+#define LUAKIT_RESOLVER(object)         (G_TYPE_CHECK_INSTANCE_CAST ((object), LUAKIT_TYPE_RESOLVER, LuakitResolver))
+#define LUAKIT_RESOLVER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),     LUAKIT_TYPE_RESOLVER, LuakitResolverClass))
+#define LUAKIT_IS_RESOLVER(object)      (G_TYPE_CHECK_INSTANCE_TYPE ((object), LUAKIT_TYPE_RESOLVER))
+
+typedef struct {
+    GResolver parent_instance;
+    /* resolver doing the actual lookups */
+    GResolver *wrapped;
+    /* cache_entry_t by hostname & lru of the entries */
+    GHashTable *cache;
+    GQueue lru;
+    /* list of waiting async lookups by hostname of lookups in progress */
+    GHashTable *pending;
+
+    guint max_entries;
+    /* time (in µs) answers & failures are cached */
+    gint64 ttl;
+    gint64 negative_ttl;
+
+    struct {
+        guint hits;
+        guint negative_hits;
+        guint misses;
+        guint lookups;
+        gdouble lookup_time;
+    } stats;
+} LuakitResolver;
+
+typedef struct {
+    GResolverClass parent_class;
+} LuakitResolverClass;
+
+GType luakit_resolver_get_type();
+LuakitResolver *luakit_resolver_new(GResolver *wrapped);
+
+gint luaH_soup_set_dns_cache(lua_State *L);
+gint luaH_soup_dns_cache_stats(lua_State *L);
+
+#endif
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
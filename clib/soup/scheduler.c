@@ -0,0 +1,220 @@
+/*
+ * clib/soup/scheduler.c - background tab request scheduling
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "clib/soup/soup.h"
+#include "clib/soup/scheduler.h"
+#include "luah.h"
+
+#include <libsoup/soup.h>
+
+/* Requests are deferred by pausing them as soon as they are queued. Before
+ * libsoup 2.42 pausing only works once the message I/O started (it fails on
+ * queued messages), so older versions don't defer anything. */
+#ifdef SOUP_CHECK_VERSION
+#if SOUP_CHECK_VERSION(2, 42, 0)
+#define SCHEDULER_CAN_DEFER
+#endif
+#endif
+
+static void luakit_scheduler_session_feature_init(SoupSessionFeatureInterface *interface, gpointer data);
+
+G_DEFINE_TYPE_WITH_CODE(LuakitScheduler, luakit_scheduler, G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE(SOUP_TYPE_SESSION_FEATURE, luakit_scheduler_session_feature_init))
+
+#define SCHEDULER_VIEW_KEY     "luakit-scheduler-view"
+#define SCHEDULER_DEFERRED_KEY "luakit-scheduler-deferred"
+
+typedef struct {
+    /* number of unpaused requests in flight */
+    guint active;
+    /* paused requests waiting for a free slot */
+    GQueue deferred;
+} view_requests_t;
+
+#ifdef SCHEDULER_CAN_DEFER
+/* Returns TRUE if the request is for the main document of the view (the
+ * navigation itself), which is never deferred */
+static gboolean
+is_main_document(SoupMessage *msg)
+{
+    SoupURI *first_party = soup_message_get_first_party(msg);
+    return !first_party || soup_uri_equal(first_party,
+            soup_message_get_uri(msg));
+}
+#endif
+
+/* Returns TRUE if the view is in a notebook but not its current page */
+static gboolean
+view_is_background(widget_t *w)
+{
+    GtkWidget *parent = gtk_widget_get_parent(w->widget);
+    if (!parent || !GTK_IS_NOTEBOOK(parent))
+        return FALSE;
+
+    GtkNotebook *nb = GTK_NOTEBOOK(parent);
+    return gtk_notebook_get_nth_page(nb,
+            gtk_notebook_get_current_page(nb)) != w->widget;
+}
+
+static void
+release_message(view_requests_t *vr, SoupMessage *msg)
+{
+    g_object_set_data(G_OBJECT(msg), SCHEDULER_DEFERRED_KEY, NULL);
+    vr->active++;
+    soup_session_unpause_message(soupconf.session, msg);
+}
+
+static void
+request_queued(SoupSessionFeature *feature, SoupSession *session,
+        SoupMessage *msg)
+{
+    LuakitScheduler *s = LUAKIT_SCHEDULER(feature);
+    widget_t *w;
+
+    if (!s->enabled || !(w = soup_message_get_view(msg)))
+        return;
+
+    view_requests_t *vr = g_hash_table_lookup(s->views, w);
+    if (!vr) {
+        vr = g_new0(view_requests_t, 1);
+        g_hash_table_insert(s->views, w, vr);
+    }
+
+    g_object_set_data(G_OBJECT(msg), SCHEDULER_VIEW_KEY, w);
+
+#ifdef SCHEDULER_CAN_DEFER
+    if (vr->active >= s->background_limit && view_is_background(w)
+            && !is_main_document(msg)) {
+        g_object_set_data(G_OBJECT(msg), SCHEDULER_DEFERRED_KEY,
+                GINT_TO_POINTER(TRUE));
+        g_queue_push_tail(&vr->deferred, msg);
+        soup_session_pause_message(session, msg);
+        return;
+    }
+#else
+    (void) session;
+#endif
+    vr->active++;
+}
+
+static void
+request_unqueued(SoupSessionFeature *feature, SoupSession *session,
+        SoupMessage *msg)
+{
+    (void) session;
+    LuakitScheduler *s = LUAKIT_SCHEDULER(feature);
+    widget_t *w = g_object_get_data(G_OBJECT(msg), SCHEDULER_VIEW_KEY);
+    view_requests_t *vr;
+
+    if (!w || !(vr = g_hash_table_lookup(s->views, w)))
+        return;
+
+    if (g_object_get_data(G_OBJECT(msg), SCHEDULER_DEFERRED_KEY))
+        g_queue_remove(&vr->deferred, msg);
+    else {
+        vr->active--;
+        /* the view might be gone already, in which case WebKit is busy
+         * cancelling the deferred requests anyway */
+        gboolean background = soup_message_get_view(msg) && view_is_background(w);
+        while (!g_queue_is_empty(&vr->deferred)
+                && (!background || vr->active < s->background_limit))
+            release_message(vr, g_queue_pop_head(&vr->deferred));
+    }
+
+    if (!vr->active && g_queue_is_empty(&vr->deferred))
+        g_hash_table_remove(s->views, w);
+}
+
+/* Releases all deferred requests of the given view, called when the view
+ * becomes the current page of its notebook. */
+void
+soup_scheduler_promote(widget_t *w)
+{
+    view_requests_t *vr = g_hash_table_lookup(soupconf.scheduler->views, w);
+    if (vr)
+        while (!g_queue_is_empty(&vr->deferred))
+            release_message(vr, g_queue_pop_head(&vr->deferred));
+}
+
+static void
+promote_view(gpointer w, gpointer vr, gpointer data)
+{
+    (void) vr;
+    (void) data;
+    soup_scheduler_promote(w);
+}
+
+/* Updates the scheduler settings from the given table:
+ *   enabled          - defer requests of background tabs (default true)
+ *   background_limit - concurrent requests per background tab */
+gint
+luaH_soup_set_scheduler(lua_State *L)
+{
+    LuakitScheduler *s = soupconf.scheduler;
+    luaH_checktable(L, 1);
+
+    s->enabled = luaH_getopt_boolean(L, 1, "enabled", s->enabled);
+    s->background_limit = MAX(1, luaH_getopt_number(L, 1, "background_limit",
+                s->background_limit));
+
+    /* requests already deferred wouldn't be released otherwise */
+    if (!s->enabled)
+        g_hash_table_foreach(s->views, promote_view, NULL);
+
+    return 0;
+}
+
+static void
+finalize(GObject *object)
+{
+    g_hash_table_destroy(LUAKIT_SCHEDULER(object)->views);
+    G_OBJECT_CLASS(luakit_scheduler_parent_class)->finalize(object);
+}
+
+static void
+luakit_scheduler_class_init(LuakitSchedulerClass *klass)
+{
+    G_OBJECT_CLASS(klass)->finalize = finalize;
+}
+
+static void
+luakit_scheduler_init(LuakitScheduler *s)
+{
+    s->enabled = TRUE;
+    s->background_limit = 2;
+    s->views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+}
+
+static void
+luakit_scheduler_session_feature_init(SoupSessionFeatureInterface *interface,
+        gpointer data)
+{
+    (void) data;
+    interface->request_queued = request_queued;
+    interface->request_unqueued = request_unqueued;
+}
+
+LuakitScheduler *
+luakit_scheduler_new()
+{
+    return g_object_new(LUAKIT_TYPE_SCHEDULER, NULL);
+}
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
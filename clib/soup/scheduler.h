@@ -0,0 +1,54 @@
+/*
+ * clib/soup/scheduler.h - background tab request scheduling
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LUAKIT_CLIB_SOUP_SCHEDULER_H
+#define LUAKIT_CLIB_SOUP_SCHEDULER_H
+
+#include "clib/widget.h"
+
+#include <glib-object.h>
+
+#define LUAKIT_TYPE_SCHEDULER            (luakit_scheduler_get_type ())
+#define LUAKIT_SCHEDULER(object)         (G_TYPE_CHECK_INSTANCE_CAST ((object), LUAKIT_TYPE_SCHEDULER, LuakitScheduler))
+#define LUAKIT_SCHEDULER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),     LUAKIT_TYPE_SCHEDULER, LuakitSchedulerClass))
+#define LUAKIT_IS_SCHEDULER(object)      (G_TYPE_CHECK_INSTANCE_TYPE ((object), LUAKIT_TYPE_SCHEDULER))
+
+typedef struct {
+    GObject parent_instance;
+    gboolean enabled;
+    /* max concurrent requests of a view in a background tab */
+    guint background_limit;
+    /* request queues by view */
+    GHashTable *views;
+} LuakitScheduler;
+
+typedef struct {
+    GObjectClass parent_class;
+} LuakitSchedulerClass;
+
+GType luakit_scheduler_get_type();
+LuakitScheduler *luakit_scheduler_new();
+
+void soup_scheduler_promote(widget_t *w);
+gint luaH_soup_set_scheduler(lua_State *L);
+
+#endif
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
@@ -144,6 +144,123 @@ luaH_soup_push_uri(lua_State *L, SoupURI *uri)
     return 1;
 }
 
+/* WebKit doesn't tell which view a message was queued for, so the uri of
+ * every request a view is about to start is remembered here until the
+ * matching message enters the session queue. */
+static GHashTable *pending_requests = NULL;
+
+/* requests which never hit the session (i.e. cached resources) leave stale
+ * entries behind, flush those once the table grows past this size */
+#define PENDING_REQUESTS_MAX 512
+
+typedef struct {
+    guint view;
+    gint64 time;
+} pending_request_t;
+
+/* Requests refer to their view by an id which is handed out when the view
+ * is created and revoked when it is destroyed, so a request outliving its
+ * view can never be charged to another view reusing the same address. */
+static GHashTable *live_views = NULL;
+static guint last_view_id = 0;
+
+#define VIEW_ID_KEY "luakit-view-id"
+
+void
+soup_view_attach(widget_t *w)
+{
+    if (!live_views)
+        live_views = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    /* zero is reserved for "no view" */
+    if (!++last_view_id)
+        ++last_view_id;
+    g_hash_table_insert(live_views, GUINT_TO_POINTER(last_view_id), w);
+    g_object_set_data(G_OBJECT(w->widget), VIEW_ID_KEY,
+            GUINT_TO_POINTER(last_view_id));
+}
+
+void
+soup_view_detach(widget_t *w)
+{
+    if (!live_views || !w->widget)
+        return;
+    gpointer id = g_object_get_data(G_OBJECT(w->widget), VIEW_ID_KEY);
+    g_hash_table_remove(live_views, id);
+    g_object_set_data(G_OBJECT(w->widget), VIEW_ID_KEY, NULL);
+}
+
+static gchar*
+request_key(SoupURI *uri)
+{
+    /* fragments never make it to the server */
+    SoupURI *copy = soup_uri_copy(uri);
+    soup_uri_set_fragment(copy, NULL);
+    gchar *key = soup_uri_to_string(copy, FALSE);
+    soup_uri_free(copy);
+    return key;
+}
+
+static gboolean
+pending_request_expired(gpointer key, pending_request_t *p, gint64 *cutoff)
+{
+    (void) key;
+    return p->time < *cutoff;
+}
+
+void
+soup_request_set_view(const gchar *str, widget_t *w)
+{
+    guint id = w->widget ? GPOINTER_TO_UINT(
+            g_object_get_data(G_OBJECT(w->widget), VIEW_ID_KEY)) : 0;
+    if (!id)
+        return;
+
+    SoupURI *uri = soup_uri_new(str);
+    if (!uri)
+        return;
+
+    if (!pending_requests)
+        pending_requests = g_hash_table_new_full(g_str_hash, g_str_equal,
+                g_free, g_free);
+
+    gint64 now = g_get_monotonic_time();
+    if (g_hash_table_size(pending_requests) > PENDING_REQUESTS_MAX) {
+        gint64 cutoff = now - 10 * G_USEC_PER_SEC;
+        g_hash_table_foreach_remove(pending_requests,
+                (GHRFunc) pending_request_expired, &cutoff);
+    }
+
+    pending_request_t *p = g_new(pending_request_t, 1);
+    p->view = id;
+    p->time = now;
+    g_hash_table_replace(pending_requests, request_key(uri), p);
+    soup_uri_free(uri);
+}
+
+/* Returns the view which started the given message or NULL if the message
+ * wasn't started by a view or the view has since been destroyed. */
+widget_t*
+soup_message_get_view(SoupMessage *msg)
+{
+    guint id = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(msg), VIEW_ID_KEY));
+
+    if (!id && pending_requests) {
+        gchar *key = request_key(soup_message_get_uri(msg));
+        pending_request_t *p = g_hash_table_lookup(pending_requests, key);
+        if (p) {
+            id = p->view;
+            g_object_set_data(G_OBJECT(msg), VIEW_ID_KEY, GUINT_TO_POINTER(id));
+            g_hash_table_remove(pending_requests, key);
+        }
+        g_free(key);
+    }
+
+    if (!id || !live_views)
+        return NULL;
+    return g_hash_table_lookup(live_views, GUINT_TO_POINTER(id));
+}
+
 static gint
 luaH_soup_parse_uri(lua_State *L)
 {
@@ -175,12 +292,20 @@ soup_lib_setup(lua_State *L)
     static const struct luaL_reg soup_lib[] =
     {
         LUA_CLASS_METHODS(soup)
-        { "set_property",  luaH_soup_set_property },
-        { "get_property",  luaH_soup_get_property },
-        { "parse_uri",     luaH_soup_parse_uri },
-        { "uri_tostring",  luaH_soup_uri_tostring },
-        { "add_cookies",   luaH_cookiejar_add_cookies },
-        { NULL,            NULL },
+        { "set_property",     luaH_soup_set_property },
+        { "get_property",     luaH_soup_get_property },
+        { "parse_uri",        luaH_soup_parse_uri },
+        { "uri_tostring",     luaH_soup_uri_tostring },
+        { "add_cookies",      luaH_cookiejar_add_cookies },
+        { "network_stats",    luaH_soup_network_stats },
+        { "prefetch",         luaH_soup_prefetch },
+        { "set_prefetch",     luaH_soup_set_prefetch },
+        { "prefetch_stats",   luaH_soup_prefetch_stats },
+        { "set_header_rules", luaH_soup_set_header_rules },
+        { "set_scheduler",    luaH_soup_set_scheduler },
+        { "set_dns_cache",    luaH_soup_set_dns_cache },
+        { "dns_cache_stats",  luaH_soup_dns_cache_stats },
+        { NULL,               NULL },
     };
 
     /* create signals array */
@@ -189,12 +314,33 @@ soup_lib_setup(lua_State *L)
     /* hash soup properties table */
     soup_properties = hash_properties(soup_properties_table);
 
+    /* cache dns answers for the session (and everything else) */
+    GResolver *resolver = g_resolver_get_default();
+    soupconf.resolver = luakit_resolver_new(resolver);
+    g_resolver_set_default(G_RESOLVER(soupconf.resolver));
+    g_object_unref(resolver);
+
     /* init soup struct */
     soupconf.cookiejar = luakit_cookie_jar_new();
     soupconf.session = webkit_get_default_session();
     soup_session_add_feature(soupconf.session,
             (SoupSessionFeature*) soupconf.cookiejar);
 
+    /* collect request timings */
+    soupconf.netstats = luakit_net_stats_new();
+    soup_session_add_feature(soupconf.session,
+            (SoupSessionFeature*) soupconf.netstats);
+
+    /* rewrite request headers */
+    soupconf.headers = luakit_header_rules_new();
+    soup_session_add_feature(soupconf.session,
+            (SoupSessionFeature*) soupconf.headers);
+
+    /* defer requests of background tabs */
+    soupconf.scheduler = luakit_scheduler_new();
+    soup_session_add_feature(soupconf.session,
+            (SoupSessionFeature*) soupconf.scheduler);
+
     /* watch for property changes */
     g_signal_connect(G_OBJECT(soupconf.session), "notify",
             G_CALLBACK(soup_notify_cb), NULL);
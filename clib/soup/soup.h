@@ -23,6 +23,12 @@
 
 #include "clib/soup/cookiejar.h"
 #include "clib/soup/auth.h"
+#include "clib/soup/headers.h"
+#include "clib/soup/netstats.h"
+#include "clib/soup/prefetch.h"
+#include "clib/soup/resolver.h"
+#include "clib/soup/scheduler.h"
+#include "clib/widget.h"
 #include "luah.h"
 
 #include <libsoup/soup-session.h>
@@ -33,6 +39,14 @@ typedef struct {
     SoupSession *session;
     /* shared custom cookie jar */
     LuakitCookieJar *cookiejar;
+    /* per-request network timing instrumentation */
+    LuakitNetStats *netstats;
+    /* per-domain request header rules */
+    LuakitHeaderRules *headers;
+    /* background tab request scheduler */
+    LuakitScheduler *scheduler;
+    /* caching resolver installed as the default resolver */
+    LuakitResolver *resolver;
 } soup_t;
 
 soup_t soupconf;
@@ -42,6 +56,10 @@ lua_class_t soup_class;
 
 void soup_lib_setup(lua_State *L);
 gint luaH_soup_push_uri(lua_State *L, SoupURI *uri);
+void soup_view_attach(widget_t *w);
+void soup_view_detach(widget_t *w);
+void soup_request_set_view(const gchar *uri, widget_t *w);
+widget_t *soup_message_get_view(SoupMessage *msg);
 
 #endif
 
@@ -23,6 +23,7 @@
 #include "common/luaclass.h"
 #include "globalconf.h"
 
+#include <glib.h>
 #include <sqlite3.h>
 #include <time.h>
 
@@ -38,8 +39,39 @@ typedef struct {
     sqlite3 *db;
     /** Internal count of rows returned from the last SQL query. */
     guint rows;
+    /** Number of queued or running \ref luaH_sqlite3_exec_async queries. */
+    guint pending;
+    /** Connection handle closed while async queries were still pending, it
+        is closed once the last of them completes. */
+    sqlite3 *closing;
 } sqlite3_t;
 
+/** Internal data structure for a query run by \ref luaH_sqlite3_exec_async. */
+typedef struct {
+    /** The \c sqlite3 object the query runs on. */
+    sqlite3_t *sqlite;
+    /** Reference to the \c sqlite3 object (prevents collection). */
+    gpointer ref;
+    /** Connection handle at the time the query was queued. */
+    sqlite3 *db;
+    /** SQL query. */
+    gchar *sql;
+    /** Database busy timeout in ms. */
+    gint timeout;
+    /** Result rows, each a \c NULL terminated array of column name and
+        value pairs. */
+    GPtrArray *rows;
+    /** Error message or \c NULL if the query succeeded. */
+    gchar *error;
+    /** Time taken to execute the query (in seconds). */
+    gdouble time;
+    /** Reference to the Lua callback function. */
+    gpointer callback;
+} exec_job_t;
+
+/** Thread pool running all async queries (one at a time, in order). */
+static GThreadPool *exec_pool;
+
 static lua_class_t sqlite3_class;
 LUA_OBJECT_FUNCS(sqlite3_class, sqlite3_t, sqlite3)
 
@@ -64,7 +96,11 @@ luaH_sqlite3_close(lua_State *L)
     }
 
     if (sqlite->db) {
-        sqlite3_close(sqlite->db);
+        /* async queries still hold the handle */
+        if (sqlite->pending)
+            sqlite->closing = sqlite->db;
+        else
+            sqlite3_close(sqlite->db);
         sqlite->db = NULL;
     }
 
@@ -180,6 +216,15 @@ luaH_sqlite3_changes(lua_State *L)
     return 0;
 }
 
+/** Data passed to \ref exec_callback. The query may run in a coroutine so
+ * the results have to be pushed on the stack of the calling Lua thread. */
+typedef struct {
+    /** The Lua thread running the query. */
+    lua_State *L;
+    /** The \c sqlite3 object the query runs on. */
+    sqlite3_t *sqlite;
+} exec_data_t;
+
 /** A \c sqlite3_exec callback function which is invoked for each result
  * row coming out of the evaluated SQL. All column data is inserted into table
  * fields (indexed by their relevant column names) and the resulting table is
@@ -187,7 +232,7 @@ luaH_sqlite3_changes(lua_State *L)
  * \ref luaH_sqlite3_exec function.
  * \see http://www.sqlite.org/c3ref/exec.html
  *
- * \param data    Pointer to a \c sqlite3_t struct.
+ * \param data    Pointer to a \c exec_data_t struct.
  * \param argc    Number of columns in the result.
  * \param argv    An array of pointers to strings obtained as if from
  *                \c sqlite3_column_text(), one for each column.
@@ -201,7 +246,7 @@ luaH_sqlite3_changes(lua_State *L)
 static int
 exec_callback (gpointer data, gint argc, gchar **argv, gchar **colname)
 {
-    lua_State *L = globalconf.L;
+    lua_State *L = ((exec_data_t*)data)->L;
     /* create row table */
     lua_createtable(L, 0, argc);
 
@@ -218,7 +263,7 @@ exec_callback (gpointer data, gint argc, gchar **argv, gchar **colname)
     }
 
     /* increment row count and insert row into main results table */
-    lua_rawseti(L, -2, ++(((sqlite3_t*)data)->rows));
+    lua_rawseti(L, -2, ++(((exec_data_t*)data)->sqlite->rows));
     return 0;
 }
 
@@ -268,7 +313,8 @@ luaH_sqlite3_exec(lua_State *L)
     /* record time taken to exec query & build return table */
     clock_gettime(CLOCK_REALTIME, &ts1);
 
-    if (sqlite3_exec(sqlite->db, sql, exec_callback, sqlite, &error)) {
+    exec_data_t data = { L, sqlite };
+    if (sqlite3_exec(sqlite->db, sql, exec_callback, &data, &error)) {
         lua_pushfstring(L, "sqlite3: failed to execute query: %s", error);
         sqlite3_free(error);
         lua_error(L);
@@ -292,6 +338,168 @@ luaH_sqlite3_exec(lua_State *L)
     return 2;
 }
 
+/** A \c sqlite3_exec callback function used by async queries. Runs in the
+ * query thread so the row is only copied into the job's \ref exec_job_t::rows
+ * array, the Lua tables are built once the query completes.
+ *
+ * \param data    Pointer to a \c exec_job_t struct.
+ * \param argc    Number of columns in the result.
+ * \param argv    Column values.
+ * \param colname Column names.
+ */
+static int
+exec_async_callback(gpointer data, gint argc, gchar **argv, gchar **colname)
+{
+    exec_job_t *job = data;
+    gchar **row = g_new0(gchar*, 2 * argc + 1);
+
+    for (gint i = 0, n = 0; i < argc; i++) {
+        /* ignore null elements */
+        if (!argv[i])
+            continue;
+        row[n++] = g_strdup(colname[i]);
+        row[n++] = g_strdup(argv[i]);
+    }
+
+    g_ptr_array_add(job->rows, row);
+    return 0;
+}
+
+/** Completes an async query on the main thread: builds the result table,
+ * emits the "execute" signal and calls the callback.
+ *
+ * \param job The completed query.
+ */
+static gboolean
+exec_async_complete(exec_job_t *job)
+{
+    lua_State *L = globalconf.L;
+    gint top = lua_gettop(L);
+    sqlite3_t *sqlite = job->sqlite;
+
+    if (!--sqlite->pending && sqlite->closing) {
+        sqlite3_close(sqlite->closing);
+        sqlite->closing = NULL;
+    }
+
+    luaH_object_push(L, job->callback);
+
+    if (job->error) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "sqlite3: failed to execute query: %s", job->error);
+    } else {
+        debug("Async query OK, %d rows returned (%f sec)", job->rows->len,
+                job->time);
+
+        /* push sql query & query time to "execute" signal */
+        luaH_object_push(L, job->ref);
+        lua_pushstring(L, job->sql);
+        lua_pushnumber(L, job->time);
+        luaH_object_emit_signal(L, -3, "execute", 2, 0);
+        lua_pop(L, 1);
+
+        lua_createtable(L, job->rows->len, 0);
+        for (guint i = 0; i < job->rows->len; i++) {
+            gchar **row = g_ptr_array_index(job->rows, i);
+            lua_newtable(L);
+            for (gint n = 0; row[n]; n += 2) {
+                lua_pushstring(L, row[n]);
+                lua_pushstring(L, row[n+1]);
+                lua_rawset(L, -3);
+            }
+            lua_rawseti(L, -2, i + 1);
+        }
+        lua_pushnumber(L, job->rows->len);
+    }
+
+    if (lua_pcall(L, 2, 0, 0))
+        warn("error in exec_async callback: %s", lua_tostring(L, -1));
+    lua_settop(L, top);
+
+    luaH_object_unref(L, job->callback);
+    luaH_object_unref(L, job->ref);
+    g_ptr_array_foreach(job->rows, (GFunc) g_strfreev, NULL);
+    g_ptr_array_free(job->rows, TRUE);
+    g_free(job->error);
+    g_free(job->sql);
+    g_free(job);
+    return FALSE;
+}
+
+/** Runs an async query in the query thread.
+ *
+ * \param job  The query to run.
+ * \param data Unused.
+ */
+static void
+exec_async_run(exec_job_t *job, gpointer data)
+{
+    (void) data;
+    gchar *error = NULL;
+    struct timespec ts1, ts2;
+
+    clock_gettime(CLOCK_REALTIME, &ts1);
+    sqlite3_busy_timeout(job->db, job->timeout);
+    if (sqlite3_exec(job->db, job->sql, exec_async_callback, job, &error)) {
+        job->error = g_strdup(error ? error : sqlite3_errmsg(job->db));
+        sqlite3_free(error);
+    }
+    clock_gettime(CLOCK_REALTIME, &ts2);
+    job->time = (ts2.tv_sec + (ts2.tv_nsec/1e9))
+              - (ts1.tv_sec + (ts1.tv_nsec/1e9));
+
+    g_idle_add((GSourceFunc) exec_async_complete, job);
+}
+
+/** Execute a SQLite3 SQL query in a background thread. Queries are run one
+ * at a time in the order they were queued. Once the query completes the
+ * "execute" signal is emitted and the callback is called with the same
+ * return values as \ref luaH_sqlite3_exec or \c nil and an error message.
+ *
+ * \param L The Lua VM state.
+ *
+ * \luastack
+ * \lparam  A \c sqlite3 object.
+ * \lvalue  String of one or more valid SQL expressions.
+ * \lvalue  Callback function.
+ * \lvalue  Database busy timeout in ms (default 1000ms).
+ */
+static gint
+luaH_sqlite3_exec_async(lua_State *L)
+{
+    sqlite3_t *sqlite = luaH_checksqlite3(L, 1);
+    const gchar *sql = luaL_checkstring(L, 2);
+    luaH_checkfunction(L, 3);
+    gint timeout = luaL_optnumber(L, 4, 1000);
+
+    /* check database open */
+    if (!sqlite->db) {
+        lua_pushliteral(L, "sqlite3: database closed");
+        lua_error(L);
+    }
+
+    if (!exec_pool)
+        exec_pool = g_thread_pool_new((GFunc) exec_async_run, NULL, 1,
+                FALSE, NULL);
+
+    debug("async: %s", sql);
+
+    exec_job_t *job = g_new0(exec_job_t, 1);
+    job->sqlite = sqlite;
+    job->db = sqlite->db;
+    job->sql = g_strdup(sql);
+    job->timeout = timeout;
+    job->rows = g_ptr_array_new();
+    lua_pushvalue(L, 3);
+    job->callback = luaH_object_ref(L, -1);
+    lua_pushvalue(L, 1);
+    job->ref = luaH_object_ref(L, -1);
+
+    sqlite->pending++;
+    g_thread_pool_push(exec_pool, job, NULL);
+    return 0;
+}
+
 /** Create a new \c sqlite3 instance.
  *
  * \param L The Lua VM state.
@@ -334,6 +542,7 @@ sqlite3_class_setup(lua_State *L)
         LUA_OBJECT_META(sqlite3)
         LUA_CLASS_META
         { "exec", luaH_sqlite3_exec },
+        { "exec_async", luaH_sqlite3_exec_async },
         { "close", luaH_sqlite3_close },
         { "changes", luaH_sqlite3_changes },
         { "__gc", luaH_sqlite3_gc },
@@ -1,5 +1,5 @@
 /*
- * timer.c - Simple timer class
+ * timer.c - Timer class backed by a shared timer wheel
  *
  * Copyright © 2010 Fabian Streitel <karottenreibe@gmail.com>
  * Copyright © 2010 Mason Larobina <mason.larobina@gmail.com>
@@ -27,48 +27,372 @@
 
 #include <glib.h>
 
-typedef struct {
+/* All timers share one hierarchical timer wheel which is driven by a single
+ * main loop source that only wakes up when the next timer is due. Each timer
+ * may fire up to `slack` ms late, which is used to round its expiry so that
+ * timers with close deadlines fire in the same wakeup. */
+
+/* ms per tick of the wheel */
+#define WHEEL_TICK   4
+#define WHEEL_BITS   6
+#define WHEEL_SIZE   (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 5
+/* furthest (in ticks) a timer can be placed in the wheel */
+#define WHEEL_MAX    (((gint64) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+typedef struct ltimer_t {
     LUA_OBJECT_HEADER
     gpointer ref;
-    int id;
     int interval;
+    int slack;
+    gboolean has_slack;
+    gboolean started;
+    /* function of timers created with timer.once */
+    gpointer once;
+    /* time (in ms of the wheel clock) the timer is due */
+    gint64 deadline;
+    /* tick the timer fires at */
+    gint64 expires;
+    /* the wheel slot the timer is in */
+    struct ltimer_t **list;
+    struct ltimer_t *prev;
+    struct ltimer_t *next;
 } ltimer_t;
 
 static lua_class_t timer_class;
 LUA_OBJECT_FUNCS(timer_class, ltimer_t, timer)
 
-#define TIMER_STOPPED -1
-
 #define luaH_checktimer(L, idx) luaH_checkudata(L, idx, &(timer_class))
 
+static struct {
+    GSource *source;
+    /* monotonic time (in µs) the wheel clock started at */
+    gint64 start;
+    /* next tick to process */
+    gint64 ticks;
+    /* number of started timers */
+    guint count;
+    /* cached tick of the next expiring timer (-1 for none) */
+    gint64 next;
+    gboolean next_valid;
+    ltimer_t *slots[WHEEL_LEVELS][WHEEL_SIZE];
+} wheel;
+
+/* timers which expired in the tick being processed */
+static ltimer_t *expired = NULL;
+
+static void timer_fire(ltimer_t *timer);
+
+static gint64
+wheel_now(void)
+{
+    return (g_get_monotonic_time() - wheel.start) / 1000;
+}
+
+static void
+timer_list_add(ltimer_t **list, ltimer_t *timer)
+{
+    timer->list = list;
+    timer->prev = NULL;
+    timer->next = *list;
+    if (*list)
+        (*list)->prev = timer;
+    *list = timer;
+}
+
+static void
+timer_list_remove(ltimer_t *timer)
+{
+    if (!timer->list)
+        return;
+    if (timer->prev)
+        timer->prev->next = timer->next;
+    else
+        *timer->list = timer->next;
+    if (timer->next)
+        timer->next->prev = timer->prev;
+    timer->list = NULL;
+    timer->prev = timer->next = NULL;
+}
+
+/* Places the timer in the slot of the level matching the distance to its
+ * expiry, each level is WHEEL_SIZE times coarser than the one below. */
+static void
+wheel_insert(ltimer_t *timer)
+{
+    gint64 expires = timer->expires;
+    gint64 delta = expires - wheel.ticks;
+    gint level = 0;
+
+    if (delta < 0) {
+        /* overdue, fire on the next tick */
+        expires = wheel.ticks;
+        delta = 0;
+    } else if (delta > WHEEL_MAX) {
+        /* too far away, gets reinserted once its slot comes up */
+        expires = wheel.ticks + WHEEL_MAX;
+        delta = WHEEL_MAX;
+    }
+
+    while (level < WHEEL_LEVELS - 1
+            && delta >= ((gint64) 1 << (WHEEL_BITS * (level + 1))))
+        level++;
+
+    gint slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    timer_list_add(&wheel.slots[level][slot], timer);
+    wheel.next_valid = FALSE;
+}
+
+static void
+wheel_remove(ltimer_t *timer)
+{
+    timer_list_remove(timer);
+    wheel.next_valid = FALSE;
+}
+
+/* Moves the timers of a slot one level down */
+static void
+wheel_cascade(gint level, gint slot)
+{
+    ltimer_t *timer;
+    while ((timer = wheel.slots[level][slot])) {
+        timer_list_remove(timer);
+        wheel_insert(timer);
+    }
+}
+
+/* Returns the tick of the next expiring timer or -1 if there are none. The
+ * slots of a level hold consecutive ranges of time starting at the current
+ * position of the level, so only the first non-empty slot of each level has
+ * to be looked at. */
+static gint64
+wheel_next_expiry(void)
+{
+    if (wheel.next_valid)
+        return wheel.next;
+
+    wheel.next = -1;
+    wheel.next_valid = TRUE;
+    if (!wheel.count)
+        return -1;
+
+    for (gint level = 0; level < WHEEL_LEVELS; level++) {
+        gint base = (wheel.ticks >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        /* above level 0 the current slot holds the furthest timers */
+        gint first = level ? 1 : 0;
+        for (gint i = first; i < first + WHEEL_SIZE; i++) {
+            ltimer_t *timer = wheel.slots[level][(base + i) & WHEEL_MASK];
+            if (!timer)
+                continue;
+            for (; timer; timer = timer->next)
+                if (wheel.next < 0 || timer->expires < wheel.next)
+                    wheel.next = timer->expires;
+            break;
+        }
+    }
+    return wheel.next;
+}
+
+/* Processes all ticks up to (and including) `now` */
+static void
+wheel_run(gint64 now)
+{
+    ltimer_t *timer;
+
+    while (wheel.ticks <= now) {
+        /* nothing to wait for, jump ahead */
+        if (!wheel.count) {
+            wheel.ticks = now + 1;
+            break;
+        }
+
+        gint index = wheel.ticks & WHEEL_MASK;
+
+        /* refill the lower levels each time they wrap */
+        if (!index) {
+            for (gint level = 1; level < WHEEL_LEVELS; level++) {
+                gint slot = (wheel.ticks >> (WHEEL_BITS * level)) & WHEEL_MASK;
+                wheel_cascade(level, slot);
+                if (slot)
+                    break;
+            }
+        }
+
+        /* move the expired timers out of the wheel so timer handlers can
+         * safely start & stop other timers */
+        while ((timer = wheel.slots[0][index])) {
+            timer_list_remove(timer);
+            timer_list_add(&expired, timer);
+        }
+        wheel.ticks++;
+        wheel.next_valid = FALSE;
+
+        while ((timer = expired)) {
+            timer_list_remove(timer);
+            /* only happens to timers further away than WHEEL_MAX */
+            if (timer->expires >= wheel.ticks)
+                wheel_insert(timer);
+            else
+                timer_fire(timer);
+        }
+    }
+}
+
+static gboolean
+wheel_prepare(GSource *source, gint *timeout)
+{
+    (void) source;
+    gint64 next = wheel_next_expiry();
+
+    if (next < 0) {
+        *timeout = -1;
+        return FALSE;
+    }
+
+    gint64 ms = next * WHEEL_TICK - wheel_now();
+    if (ms <= 0) {
+        *timeout = 0;
+        return TRUE;
+    }
+
+    *timeout = MIN(ms, G_MAXINT);
+    return FALSE;
+}
+
+static gboolean
+wheel_check(GSource *source)
+{
+    (void) source;
+    gint64 next = wheel_next_expiry();
+    return next >= 0 && next * WHEEL_TICK <= wheel_now();
+}
+
+static gboolean
+wheel_dispatch(GSource *source, GSourceFunc callback, gpointer data)
+{
+    (void) source;
+    (void) callback;
+    (void) data;
+    wheel_run(wheel_now() / WHEEL_TICK);
+    return TRUE;
+}
+
+static GSourceFuncs wheel_funcs = {
+    wheel_prepare,
+    wheel_check,
+    wheel_dispatch,
+    NULL, NULL, NULL
+};
+
+/* Returns the tick a timer due at `deadline` should fire at. The deadline is
+ * rounded up to the coarsest power of two ms within the slack of the timer,
+ * timers of whole seconds without an explicit slack are aligned to the full
+ * seconds of the wheel clock so they all wake up together. By default timers
+ * have a slack of 1/16th of their interval. */
+static gint64
+timer_expires(ltimer_t *timer, gint64 deadline)
+{
+    gint64 align = 1;
+
+    if (!timer->has_slack && timer->interval >= 1000
+            && !(timer->interval % 1000))
+        align = 1000;
+    else {
+        gint slack = timer->has_slack ? timer->slack : timer->interval / 16;
+        while (align * 2 <= slack)
+            align *= 2;
+    }
+
+    deadline = ((deadline + align - 1) / align) * align;
+    return (deadline + WHEEL_TICK - 1) / WHEEL_TICK;
+}
+
+static void
+timer_schedule(ltimer_t *timer)
+{
+    if (!wheel.source) {
+        wheel.start = g_get_monotonic_time();
+        wheel.source = g_source_new(&wheel_funcs, sizeof(GSource));
+        g_source_attach(wheel.source, NULL);
+    }
+
+    gint64 now = wheel_now();
+    /* the wheel doesn't advance while empty */
+    if (!wheel.count)
+        wheel.ticks = now / WHEEL_TICK;
+
+    timer->deadline = now + timer->interval;
+    timer->expires = timer_expires(timer, timer->deadline);
+    timer->started = TRUE;
+    wheel.count++;
+    wheel_insert(timer);
+}
+
 static void
 luaH_timer_destroy(lua_State *L, ltimer_t *timer) {
-    GSource *source = g_main_context_find_source_by_id(NULL, timer->id);
-    if (source != NULL)
-        g_source_destroy(source);
+    wheel_remove(timer);
+    wheel.count--;
+    timer->started = FALSE;
+
+    if (timer->once) {
+        luaH_object_unref(L, timer->once);
+        timer->once = NULL;
+    }
 
     /* allow timer to be garbage collected */
     luaH_object_unref(L, timer->ref);
     timer->ref = NULL;
-
-    timer->id = TIMER_STOPPED;
 }
 
-static gboolean
-timer_handle_timeout(gpointer data)
+static void
+timer_fire(ltimer_t *timer)
 {
-    ltimer_t *timer = (ltimer_t *) data;
-    luaH_object_push(globalconf.L, timer->ref);
-    luaH_object_emit_signal(globalconf.L, -1, "timeout", 1, 0);
-    return TRUE;
+    lua_State *L = globalconf.L;
+
+    if (timer->once) {
+        luaH_object_push(L, timer->once);
+        luaH_timer_destroy(L, timer);
+        luaH_dofunction(L, 0, 0);
+        return;
+    }
+
+    /* rearm before emitting so the handler can stop or restart the timer,
+     * deadlines missed while the main loop was busy are skipped */
+    gint64 now = wheel_now();
+    timer->deadline += timer->interval;
+    if (timer->deadline <= now)
+        timer->deadline = now + timer->interval;
+    timer->expires = timer_expires(timer, timer->deadline);
+    wheel_insert(timer);
+
+    luaH_object_push(L, timer->ref);
+    luaH_object_emit_signal(L, -1, "timeout", 1, 0);
 }
 
 static int
 luaH_timer_new(lua_State *L)
 {
     luaH_class_new(L, &timer_class);
-    ltimer_t *timer = luaH_checktimer(L, -1);
-    timer->id = TIMER_STOPPED;
+    return 1;
+}
+
+/* Calls the function once after `interval` ms:
+ *   timer.once(interval, func)
+ * returns the started timer which can be stopped to cancel the call. */
+static int
+luaH_timer_once(lua_State *L)
+{
+    gint interval = luaL_checkint(L, 1);
+    luaH_checkfunction(L, 2);
+
+    ltimer_t *timer = timer_new(L);
+    timer->interval = interval < 0 ? 0 : interval;
+    lua_pushvalue(L, 2);
+    timer->once = luaH_object_ref(L, -1);
+    lua_pushvalue(L, -1);
+    timer->ref = luaH_object_ref(L, -1);
+    timer_schedule(timer);
     return 1;
 }
 
@@ -79,10 +403,10 @@ luaH_timer_start(lua_State *L)
     if (!timer->interval)
         luaL_error(L, "interval not set");
 
-    if (timer->id == TIMER_STOPPED) {
+    if (!timer->started) {
         /* ensure timer isn't collected while running */
         timer->ref = luaH_object_ref(L, 1);
-        timer->id = g_timeout_add(timer->interval, timer_handle_timeout, timer);
+        timer_schedule(timer);
     } else
         luaH_warn(L, "timer already started");
     return 0;
@@ -92,7 +416,7 @@ static int
 luaH_timer_stop(lua_State *L)
 {
     ltimer_t *timer = luaH_checktimer(L, 1);
-    if (timer->id == TIMER_STOPPED)
+    if (!timer->started)
         luaH_warn(L, "timer already stopped");
     else
         luaH_timer_destroy(L, timer);
@@ -113,10 +437,27 @@ luaH_timer_get_interval(lua_State *L, ltimer_t *timer)
     return 1;
 }
 
+static int
+luaH_timer_set_slack(lua_State *L, ltimer_t *timer)
+{
+    timer->slack = luaL_checkint(L, -1);
+    timer->has_slack = TRUE;
+    return 0;
+}
+
+static int
+luaH_timer_get_slack(lua_State *L, ltimer_t *timer)
+{
+    if (!timer->has_slack)
+        return 0;
+    lua_pushinteger(L, timer->slack);
+    return 1;
+}
+
 static int
 luaH_timer_get_started(lua_State *L, ltimer_t *timer)
 {
-    lua_pushboolean(L, (timer->id != TIMER_STOPPED));
+    lua_pushboolean(L, timer->started);
     return 1;
 }
 
@@ -127,6 +468,7 @@ timer_class_setup(lua_State *L)
     {
         LUA_CLASS_METHODS(timer)
         { "__call", luaH_timer_new },
+        { "once", luaH_timer_once },
         { NULL, NULL }
     };
 
@@ -150,6 +492,11 @@ timer_class_setup(lua_State *L)
             (lua_class_propfunc_t) luaH_timer_get_interval,
             (lua_class_propfunc_t) luaH_timer_set_interval);
 
+    luaH_class_add_property(&timer_class, L_TK_SLACK,
+            (lua_class_propfunc_t) luaH_timer_set_slack,
+            (lua_class_propfunc_t) luaH_timer_get_slack,
+            (lua_class_propfunc_t) luaH_timer_set_slack);
+
     luaH_class_add_property(&timer_class, L_TK_STARTED,
             NULL,
             (lua_class_propfunc_t) luaH_timer_get_started,
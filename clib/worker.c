@@ -0,0 +1,424 @@
+/*
+ * clib/worker.c - background Lua worker states
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common/luaobject.h"
+#include "clib/worker.h"
+#include "globalconf.h"
+
+#include <glib.h>
+#include <lauxlib.h>
+#include <lualib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Jobs run in a pool of threads, each with its own lua_State which only has
+ * the standard libraries (and package.path/cpath of the main state). The job
+ * function and its arguments are serialized into the job, run by the first
+ * free worker and the serialized results are handed back to the main loop:
+ *
+ *   worker.run(function (data)
+ *       return parse(data)
+ *   end, { data }, function (ok, result)
+ *       ...
+ *   end)
+ *
+ * Only nil, booleans, numbers, strings and (non-recursive) tables of those
+ * can be passed in either direction. */
+
+#define WORKER_MAX_THREADS 4
+#define WORKER_MAX_DEPTH   32
+
+/* serialized value tags */
+enum {
+    WORKER_NIL   = 'n',
+    WORKER_FALSE = 'f',
+    WORKER_TRUE  = 't',
+    WORKER_NUM   = 'd',
+    WORKER_STR   = 's',
+    WORKER_TABLE = 'T',
+    WORKER_END   = 'E',
+};
+
+typedef struct {
+    /* source or bytecode of the job function */
+    GByteArray *chunk;
+    /* serialized arguments & results */
+    GByteArray *args;
+    GByteArray *results;
+    /* error message if the job failed */
+    gchar *error;
+    gpointer callback;
+} worker_job_t;
+
+static struct {
+    GThreadPool *pool;
+    /* the worker thread's lua_State */
+    GStaticPrivate state;
+    /* package.path & package.cpath of the main state */
+    gchar *path;
+    gchar *cpath;
+    guint queued;
+    guint completed;
+    guint failed;
+} worker = { NULL, G_STATIC_PRIVATE_INIT, NULL, NULL, 0, 0, 0 };
+
+static gboolean
+worker_pack_value(lua_State *L, gint idx, GByteArray *buf, gint depth,
+        gchar **error)
+{
+    guint8 tag;
+    size_t len;
+    const gchar *s;
+    lua_Number n;
+    guint32 l;
+
+    idx = luaH_absindex(L, idx);
+    switch (lua_type(L, idx)) {
+      case LUA_TNIL:
+        tag = WORKER_NIL;
+        g_byte_array_append(buf, &tag, 1);
+        return TRUE;
+
+      case LUA_TBOOLEAN:
+        tag = lua_toboolean(L, idx) ? WORKER_TRUE : WORKER_FALSE;
+        g_byte_array_append(buf, &tag, 1);
+        return TRUE;
+
+      case LUA_TNUMBER:
+        tag = WORKER_NUM;
+        n = lua_tonumber(L, idx);
+        g_byte_array_append(buf, &tag, 1);
+        g_byte_array_append(buf, (guint8*) &n, sizeof(n));
+        return TRUE;
+
+      case LUA_TSTRING:
+        tag = WORKER_STR;
+        s = lua_tolstring(L, idx, &len);
+        l = len;
+        g_byte_array_append(buf, &tag, 1);
+        g_byte_array_append(buf, (guint8*) &l, sizeof(l));
+        g_byte_array_append(buf, (guint8*) s, len);
+        return TRUE;
+
+      case LUA_TTABLE:
+        if (depth >= WORKER_MAX_DEPTH) {
+            *error = g_strdup("table nesting too deep (recursive table?)");
+            return FALSE;
+        }
+        /* not luaL_checkstack, this also runs unprotected in the workers */
+        if (!lua_checkstack(L, 2)) {
+            *error = g_strdup("table nesting too deep");
+            return FALSE;
+        }
+        tag = WORKER_TABLE;
+        g_byte_array_append(buf, &tag, 1);
+        lua_pushnil(L);
+        while (lua_next(L, idx)) {
+            if (!worker_pack_value(L, -2, buf, depth + 1, error)
+                    || !worker_pack_value(L, -1, buf, depth + 1, error)) {
+                lua_pop(L, 2);
+                return FALSE;
+            }
+            lua_pop(L, 1);
+        }
+        tag = WORKER_END;
+        g_byte_array_append(buf, &tag, 1);
+        return TRUE;
+
+      default:
+        *error = g_strdup_printf("can't pass %s values to or from workers",
+                lua_typename(L, lua_type(L, idx)));
+        return FALSE;
+    }
+}
+
+/* Serializes the values in the stack range [from, to] */
+static GByteArray*
+worker_pack(lua_State *L, gint from, gint to, gchar **error)
+{
+    GByteArray *buf = g_byte_array_new();
+    guint32 count = MAX(to - from + 1, 0);
+
+    g_byte_array_append(buf, (guint8*) &count, sizeof(count));
+    for (gint i = from; i <= to; i++) {
+        if (!worker_pack_value(L, i, buf, 0, error)) {
+            g_byte_array_free(buf, TRUE);
+            return NULL;
+        }
+    }
+    return buf;
+}
+
+/* Pushes the value at `pos` and returns the position after it */
+static gsize
+worker_unpack_value(lua_State *L, const guint8 *data, gsize pos)
+{
+    lua_Number n;
+    guint32 l;
+
+    luaL_checkstack(L, 3, "worker value nesting too deep");
+    switch (data[pos++]) {
+      case WORKER_FALSE:
+        lua_pushboolean(L, FALSE);
+        return pos;
+
+      case WORKER_TRUE:
+        lua_pushboolean(L, TRUE);
+        return pos;
+
+      case WORKER_NUM:
+        memcpy(&n, data + pos, sizeof(n));
+        lua_pushnumber(L, n);
+        return pos + sizeof(n);
+
+      case WORKER_STR:
+        memcpy(&l, data + pos, sizeof(l));
+        pos += sizeof(l);
+        lua_pushlstring(L, (const gchar*) data + pos, l);
+        return pos + l;
+
+      case WORKER_TABLE:
+        lua_newtable(L);
+        while (data[pos] != WORKER_END) {
+            pos = worker_unpack_value(L, data, pos);
+            pos = worker_unpack_value(L, data, pos);
+            lua_rawset(L, -3);
+        }
+        return pos + 1;
+
+      case WORKER_NIL:
+      default:
+        lua_pushnil(L);
+        return pos;
+    }
+}
+
+/* Pushes all values serialized by worker_pack, returns the number of values
+ * pushed */
+static gint
+worker_unpack(lua_State *L, GByteArray *buf)
+{
+    guint32 count;
+    gsize pos = sizeof(count);
+
+    memcpy(&count, buf->data, sizeof(count));
+    luaL_checkstack(L, count, "too many worker values");
+    for (guint32 i = 0; i < count; i++)
+        pos = worker_unpack_value(L, buf->data, pos);
+    return count;
+}
+
+static lua_State*
+worker_state_new(void)
+{
+    lua_State *W = luaL_newstate();
+    luaL_openlibs(W);
+
+    /* use the same module search paths as the main state */
+    lua_getglobal(W, "package");
+    lua_pushstring(W, worker.path);
+    lua_setfield(W, -2, "path");
+    lua_pushstring(W, worker.cpath);
+    lua_setfield(W, -2, "cpath");
+    lua_pop(W, 1);
+    return W;
+}
+
+static gboolean
+worker_complete_cb(worker_job_t *job)
+{
+    lua_State *L = globalconf.L;
+    gint top = lua_gettop(L);
+
+    worker.queued--;
+    if (job->error)
+        worker.failed++;
+    else
+        worker.completed++;
+
+    luaH_object_push(L, job->callback);
+    if (job->error) {
+        lua_pushboolean(L, FALSE);
+        lua_pushstring(L, job->error);
+    } else {
+        lua_pushboolean(L, TRUE);
+        worker_unpack(L, job->results);
+    }
+
+    if (lua_pcall(L, lua_gettop(L) - top - 1, 0, 0))
+        warn("error in worker callback: %s", lua_tostring(L, -1));
+    lua_settop(L, top);
+
+    luaH_object_unref(L, job->callback);
+    g_byte_array_free(job->chunk, TRUE);
+    g_byte_array_free(job->args, TRUE);
+    if (job->results)
+        g_byte_array_free(job->results, TRUE);
+    g_free(job->error);
+    g_free(job);
+    return FALSE;
+}
+
+/* Runs a job in a worker thread */
+static void
+worker_run(worker_job_t *job, gpointer data)
+{
+    (void) data;
+    lua_State *W = g_static_private_get(&worker.state);
+
+    if (!W) {
+        W = worker_state_new();
+        g_static_private_set(&worker.state, W, (GDestroyNotify) lua_close);
+    }
+
+    gint top = lua_gettop(W);
+    if (luaL_loadbuffer(W, (const gchar*) job->chunk->data, job->chunk->len,
+                "=(worker)")) {
+        job->error = g_strdup(lua_tostring(W, -1));
+    } else {
+        gint nargs = worker_unpack(W, job->args);
+        if (lua_pcall(W, nargs, LUA_MULTRET, 0))
+            job->error = lua_isstring(W, -1) ? g_strdup(lua_tostring(W, -1))
+                : g_strdup_printf("(error object is a %s value)",
+                        luaL_typename(W, -1));
+        else
+            job->results = worker_pack(W, top + 1, lua_gettop(W), &job->error);
+    }
+    lua_settop(W, top);
+
+    g_idle_add((GSourceFunc) worker_complete_cb, job);
+}
+
+static gint
+worker_dump_writer(lua_State *L, const void *p, size_t sz, void *buf)
+{
+    (void) L;
+    g_byte_array_append(buf, p, sz);
+    return 0;
+}
+
+/* Runs a function in a worker thread:
+ *   worker.run(func | source, args, callback)
+ * func must not have upvalues (it is serialized with string.dump), args is
+ * an optional array of arguments. The callback is called with true and the
+ * function's return values or false and an error message. */
+static gint
+luaH_worker_run(lua_State *L)
+{
+    lua_Debug ar;
+    gchar *error = NULL;
+    GByteArray *chunk = g_byte_array_new();
+
+    luaH_checkfunction(L, 3);
+
+    if (lua_isfunction(L, 1)) {
+        lua_pushvalue(L, 1);
+        lua_getinfo(L, ">Su", &ar);
+        if (*ar.what == 'C' || ar.nups) {
+            g_byte_array_free(chunk, TRUE);
+            luaL_argerror(L, 1, "function must be a Lua function without upvalues");
+        }
+        lua_pushvalue(L, 1);
+        lua_dump(L, worker_dump_writer, chunk);
+        lua_pop(L, 1);
+    } else {
+        size_t len;
+        const gchar *source = lua_tolstring(L, 1, &len);
+        if (!source) {
+            g_byte_array_free(chunk, TRUE);
+            luaL_typerror(L, 1, "function or string");
+        }
+        g_byte_array_append(chunk, (const guint8*) source, len);
+    }
+
+    /* serialize arguments */
+    gint nargs = 0;
+    if (lua_istable(L, 2)) {
+        nargs = lua_objlen(L, 2);
+        luaL_checkstack(L, nargs, "too many worker arguments");
+        for (gint i = 1; i <= nargs; i++)
+            lua_rawgeti(L, 2, i);
+    }
+    GByteArray *args = worker_pack(L, lua_gettop(L) - nargs + 1,
+            lua_gettop(L), &error);
+    lua_pop(L, nargs);
+    if (!args) {
+        g_byte_array_free(chunk, TRUE);
+        lua_pushstring(L, error);
+        g_free(error);
+        lua_error(L);
+    }
+
+    if (!worker.pool) {
+        /* save module search paths for the worker states */
+        lua_getglobal(L, "package");
+        lua_getfield(L, -1, "path");
+        worker.path = g_strdup(lua_tostring(L, -1));
+        lua_getfield(L, -2, "cpath");
+        worker.cpath = g_strdup(lua_tostring(L, -1));
+        lua_pop(L, 3);
+
+        glong n = sysconf(_SC_NPROCESSORS_ONLN);
+        worker.pool = g_thread_pool_new((GFunc) worker_run, NULL,
+                CLAMP(n, 1, WORKER_MAX_THREADS), FALSE, NULL);
+    }
+
+    worker_job_t *job = g_new0(worker_job_t, 1);
+    job->chunk = chunk;
+    job->args = args;
+    lua_pushvalue(L, 3);
+    job->callback = luaH_object_ref(L, -1);
+
+    worker.queued++;
+    g_thread_pool_push(worker.pool, job, NULL);
+    return 0;
+}
+
+/* Returns the number of threads, pending, completed and failed jobs */
+static gint
+luaH_worker_stats(lua_State *L)
+{
+    lua_newtable(L);
+    lua_pushnumber(L, worker.pool ? g_thread_pool_get_max_threads(worker.pool) : 0);
+    lua_setfield(L, -2, "threads");
+    lua_pushnumber(L, worker.queued);
+    lua_setfield(L, -2, "pending");
+    lua_pushnumber(L, worker.completed);
+    lua_setfield(L, -2, "completed");
+    lua_pushnumber(L, worker.failed);
+    lua_setfield(L, -2, "failed");
+    return 1;
+}
+
+void
+worker_lib_setup(lua_State *L)
+{
+    static const struct luaL_reg worker_lib[] =
+    {
+        { "run",   luaH_worker_run },
+        { "stats", luaH_worker_stats },
+        { NULL,    NULL }
+    };
+
+    /* export worker lib */
+    luaH_openlib(L, "worker", worker_lib, worker_lib);
+}
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
@@ -0,0 +1,107 @@
+/*
+ * common/histogram.c - log2 bucketed timing histograms
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common/histogram.h"
+#include "common/luastats.h"
+
+#include <lauxlib.h>
+
+/* lower bound (in ms) of the samples in the given bucket */
+inline static gdouble
+bucket_floor(gint i)
+{
+    return i ? (gdouble) (1 << (i - 1)) : 0;
+}
+
+void
+histogram_add(histogram_t *h, gdouble ms)
+{
+    gint i = 0;
+
+    if (ms < 0)
+        ms = 0;
+
+    /* find bucket */
+    while (i < HISTOGRAM_BUCKETS - 1 && ms >= bucket_floor(i + 1))
+        i++;
+
+    if (!h->count || ms < h->min)
+        h->min = ms;
+    if (!h->count || ms > h->max)
+        h->max = ms;
+
+    h->buckets[i]++;
+    h->sum += ms;
+    h->count++;
+}
+
+/* Estimates the value below which the fraction `p` of all samples fall by
+ * interpolating linearly inside the bucket holding that sample. */
+gdouble
+histogram_percentile(histogram_t *h, gdouble p)
+{
+    if (!h->count)
+        return 0;
+
+    gdouble rank = p * h->count, seen = 0, lo, hi, v;
+
+    for (gint i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (!h->buckets[i] || seen + h->buckets[i] < rank) {
+            seen += h->buckets[i];
+            continue;
+        }
+
+        lo = bucket_floor(i);
+        hi = (i == HISTOGRAM_BUCKETS - 1) ? h->max : bucket_floor(i + 1);
+        v = lo + (hi - lo) * ((rank - seen) / h->buckets[i]);
+
+        /* never report a value outside the observed range */
+        return v < h->min ? h->min : (v > h->max ? h->max : v);
+    }
+    return h->max;
+}
+
+gint
+luaH_histogram_push(lua_State *L, histogram_t *h)
+{
+    lua_createtable(L, 0, 8);
+
+    luaH_pushnumfield(L, "count", h->count);
+    luaH_pushnumfield(L, "min",   h->min);
+    luaH_pushnumfield(L, "max",   h->max);
+    luaH_pushnumfield(L, "mean",  h->count ? h->sum / h->count : 0);
+    luaH_pushnumfield(L, "p50",   histogram_percentile(h, 0.50));
+    luaH_pushnumfield(L, "p90",   histogram_percentile(h, 0.90));
+    luaH_pushnumfield(L, "p99",   histogram_percentile(h, 0.99));
+
+    /* push raw bucket counts, buckets[1] holds the samples below 1ms and
+     * buckets[n] the samples in the range [2^(n-2), 2^(n-1)) ms */
+    lua_pushliteral(L, "buckets");
+    lua_createtable(L, HISTOGRAM_BUCKETS, 0);
+    for (gint i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        lua_pushnumber(L, h->buckets[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_rawset(L, -3);
+
+    return 1;
+}
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
@@ -0,0 +1,45 @@
+/*
+ * common/histogram.h - log2 bucketed timing histograms
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LUAKIT_COMMON_HISTOGRAM_H
+#define LUAKIT_COMMON_HISTOGRAM_H
+
+#include <glib/gtypes.h>
+#include <lua.h>
+
+/* bucket 0 holds samples below 1ms, bucket n holds samples in the range
+ * [2^(n-1), 2^n) milliseconds and the last bucket holds everything else */
+#define HISTOGRAM_BUCKETS 24
+
+typedef struct {
+    guint count;
+    gdouble sum;
+    gdouble min;
+    gdouble max;
+    guint buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+void histogram_add(histogram_t *h, gdouble ms);
+gdouble histogram_percentile(histogram_t *h, gdouble p);
+gint luaH_histogram_push(lua_State *L, histogram_t *h);
+
+#endif
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
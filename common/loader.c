@@ -0,0 +1,335 @@
+/*
+ * common/loader.c - cached lua chunk loader
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common/loader.h"
+#include "common/trace.h"
+#include "common/util.h"
+#include "globalconf.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <lauxlib.h>
+#include <string.h>
+
+/* Compiled chunks are kept in $XDG_CACHE_HOME/luakit/bytecode, one file per
+ * source file named after the hash of its path. Each cache file starts with
+ * a header holding the lua version, source path, mtime (with nanoseconds, so
+ * an edit within the same second is still noticed) and size, the cached
+ * chunk is only used if all of these still match. Otherwise (or if the
+ * bytecode is rejected) the source is loaded and the cache rewritten. */
+
+#define LOADER_MAGIC "luakit-bytecode-2"
+
+static gchar *loader_version;
+
+/* Instead of probing every package.path template with a stat/fopen the
+ * module searcher lists each candidate directory once (per startup) and
+ * checks the listing, resolved module names are remembered. */
+static struct {
+    /* directory -> set of its entries (empty if it doesn't exist) */
+    GHashTable *dirs;
+    /* module name -> resolved file */
+    GHashTable *modules;
+    /* number of directories listed, candidates checked & files stat'd */
+    guint listings;
+    guint probes;
+    guint stats;
+} loader_index;
+
+static const gchar*
+loader_get_version(lua_State *L)
+{
+    if (loader_version)
+        return loader_version;
+
+    /* bytecode isn't compatible between lua and luajit (or their versions) */
+    lua_getglobal(L, "jit");
+    if (lua_istable(L, -1)) {
+        lua_getfield(L, -1, "version");
+        loader_version = g_strdup(luaL_optstring(L, -1, "LuaJIT"));
+        lua_pop(L, 1);
+    } else
+        loader_version = g_strdup(LUA_RELEASE);
+    lua_pop(L, 1);
+    return loader_version;
+}
+
+static gchar*
+loader_cache_file(const gchar *path)
+{
+    gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, path, -1);
+    gchar *name = g_strdup_printf("%s.luac", hash);
+    gchar *file = g_build_filename(globalconf.cache_dir, "bytecode", name, NULL);
+    g_free(hash);
+    g_free(name);
+    return file;
+}
+
+static gint
+loader_writer(lua_State *L, const void *p, size_t sz, void *buf)
+{
+    (void) L;
+    g_byte_array_append(buf, p, sz);
+    return 0;
+}
+
+/* Writes the function on top of the stack to the cache file */
+static void
+loader_cache_write(lua_State *L, const gchar *file, const gchar *header)
+{
+    GError *e = NULL;
+    GByteArray *buf = g_byte_array_new();
+
+    g_byte_array_append(buf, (const guint8*) header, strlen(header));
+    if (!lua_dump(L, loader_writer, buf)) {
+        gchar *dir = g_path_get_dirname(file);
+        g_mkdir_with_parents(dir, 0700);
+        g_free(dir);
+        if (!g_file_set_contents(file, (const gchar*) buf->data, buf->len, &e)) {
+            debug("unable to write bytecode cache: %s", e->message);
+            g_clear_error(&e);
+        }
+    }
+    g_byte_array_free(buf, TRUE);
+}
+
+static glong
+loader_mtime_nsec(struct stat *st)
+{
+#ifdef __APPLE__
+    return st->st_mtimespec.tv_nsec;
+#else
+    return st->st_mtim.tv_nsec;
+#endif
+}
+
+/* Same as luaL_loadfile but loads the compiled chunk from the bytecode cache
+ * if it is still up to date (and updates the cache otherwise). */
+gint
+luaH_loadfile_cached(lua_State *L, const gchar *path)
+{
+    struct stat st;
+    gchar *data = NULL;
+    gsize len = 0;
+    gint ret;
+
+    loader_index.stats++;
+    if (!globalconf.cache_dir || g_stat(path, &st))
+        return luaL_loadfile(L, path);
+
+    gchar *cwd = g_get_current_dir();
+    gchar *abspath = g_path_is_absolute(path) ? g_strdup(path)
+        : g_build_filename(cwd, path, NULL);
+    g_free(cwd);
+    gchar *file = loader_cache_file(abspath);
+    gchar *header = g_strdup_printf("%s\n%s\n%s\n%ld.%09ld\n%ld\n",
+            LOADER_MAGIC, loader_get_version(L), abspath, (glong) st.st_mtime,
+            loader_mtime_nsec(&st), (glong) st.st_size);
+    gsize hlen = strlen(header);
+    gchar *chunkname = g_strdup_printf("@%s", path);
+
+    if (g_file_get_contents(file, &data, &len, NULL) && len > hlen
+            && !memcmp(data, header, hlen)) {
+        if (!luaL_loadbuffer(L, data + hlen, len - hlen, chunkname)) {
+            debug("loaded %s from bytecode cache", path);
+            ret = 0;
+            goto done;
+        }
+        /* fall back on the source */
+        debug("rejected cached bytecode for %s: %s", path, lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+
+    if (!(ret = luaL_loadfile(L, path)))
+        loader_cache_write(L, file, header);
+
+done:
+    g_free(data);
+    g_free(chunkname);
+    g_free(header);
+    g_free(file);
+    g_free(abspath);
+    return ret;
+}
+
+/* Returns TRUE if the file is in the (cached) listing of its directory */
+static gboolean
+loader_index_has(const gchar *file)
+{
+    gchar *dir = g_path_get_dirname(file);
+    gchar *base = g_path_get_basename(file);
+    GHashTable *entries = g_hash_table_lookup(loader_index.dirs, dir);
+
+    if (!entries) {
+        const gchar *name;
+        GDir *d = g_dir_open(dir, 0, NULL);
+        entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        if (d) {
+            while ((name = g_dir_read_name(d)))
+                g_hash_table_insert(entries, g_strdup(name), GINT_TO_POINTER(1));
+            g_dir_close(d);
+        }
+        g_hash_table_insert(loader_index.dirs, g_strdup(dir), entries);
+        loader_index.listings++;
+    }
+
+    loader_index.probes++;
+    gboolean ret = g_hash_table_lookup(entries, base) != NULL;
+    g_free(dir);
+    g_free(base);
+    return ret;
+}
+
+/* Resolves a module name to the first matching package.path template */
+static const gchar*
+loader_index_find(const gchar *name, const gchar *path)
+{
+    gchar *found = g_hash_table_lookup(loader_index.modules, name);
+    if (found)
+        return found;
+
+    gchar *mod = g_strdelimit(g_strdup(name), ".", G_DIR_SEPARATOR);
+    gchar **templates = g_strsplit(path, ";", 0);
+    for (gint i = 0; !found && templates[i]; i++) {
+        if (!*templates[i])
+            continue;
+        gchar **parts = g_strsplit(templates[i], "?", 0);
+        gchar *file = g_strjoinv(mod, parts);
+        g_strfreev(parts);
+        if (loader_index_has(file))
+            found = file;
+        else
+            g_free(file);
+    }
+    g_strfreev(templates);
+    g_free(mod);
+
+    if (found)
+        g_hash_table_insert(loader_index.modules, g_strdup(name), found);
+    return found;
+}
+
+/* Runs the module chunk (upvalue 1) inside a "require" span of the startup
+ * trace */
+static gint
+luaH_loader_traced(lua_State *L)
+{
+    const gchar *name = lua_tostring(L, lua_upvalueindex(2));
+    gint nargs = lua_gettop(L);
+
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_insert(L, 1);
+    trace_begin("require", name);
+    gint status = lua_pcall(L, nargs, LUA_MULTRET, 0);
+    trace_end("require", name);
+    if (status)
+        lua_error(L);
+    return lua_gettop(L);
+}
+
+/* package.loaders entry which resolves modules through the module index
+ * (using the same package.path search order as the standard lua loader) and
+ * loads them through the bytecode cache. Returns nothing if the module
+ * wasn't found, the standard loaders then produce the usual error message. */
+static gint
+luaH_loader_cached(lua_State *L)
+{
+    const gchar *name = luaL_checkstring(L, 1);
+
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "path");
+    const gchar *path = lua_tostring(L, -1);
+    if (!path)
+        return 0;
+
+    const gchar *file = loader_index_find(name, path);
+    if (!file)
+        return 0;
+
+    if (luaH_loadfile_cached(L, file))
+        luaL_error(L, "error loading module '%s' from file '%s':\n\t%s",
+                name, file, lua_tostring(L, -1));
+
+    if (trace_enabled()) {
+        lua_pushstring(L, name);
+        lua_pushcclosure(L, luaH_loader_traced, 2);
+    }
+    return 1;
+}
+
+/* Returns the file require would load a module from (through package.path)
+ * without loading it, or nothing if it isn't found:
+ *   package.findmodule(name) */
+static gint
+luaH_loader_findmodule(lua_State *L)
+{
+    const gchar *name = luaL_checkstring(L, 1);
+
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "path");
+    const gchar *path = lua_tostring(L, -1);
+    const gchar *file = path ? loader_index_find(name, path) : NULL;
+    if (!file)
+        return 0;
+    lua_pushstring(L, file);
+    return 1;
+}
+
+/* Prints module search statistics in verbose mode */
+void
+loader_report(void)
+{
+    debug("module index: %d modules resolved with %d directory listings "
+            "(%d path candidates checked), %d files stat'd",
+            g_hash_table_size(loader_index.modules), loader_index.listings,
+            loader_index.probes, loader_index.stats);
+}
+
+/* Installs the module searcher in package.loaders ahead of the standard lua
+ * source loader (i.e. right after the preload loader) and adds
+ * package.findmodule */
+void
+loader_setup(lua_State *L)
+{
+    loader_index.dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+            (GDestroyNotify) g_hash_table_destroy);
+    loader_index.modules = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, g_free);
+
+    lua_getglobal(L, "package");
+    lua_pushcfunction(L, luaH_loader_findmodule);
+    lua_setfield(L, -2, "findmodule");
+    lua_getfield(L, -1, "loaders");
+    if (!lua_istable(L, -1)) {
+        warn("package.loaders is not a table");
+        lua_pop(L, 2);
+        return;
+    }
+
+    for (gint i = lua_objlen(L, -1); i >= 2; i--) {
+        lua_rawgeti(L, -1, i);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_pushcfunction(L, luaH_loader_cached);
+    lua_rawseti(L, -2, 2);
+    lua_pop(L, 2);
+}
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
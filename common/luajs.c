@@ -0,0 +1,413 @@
+/*
+ * common/luajs.c - javascript <-> lua value conversion
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common/luajs.h"
+#include "common/util.h"
+
+#include <lauxlib.h>
+
+static gchar*
+jsstring_to_utf8(JSStringRef str, size_t *len)
+{
+    size_t size = JSStringGetMaximumUTF8CStringSize(str);
+    gchar *ret = g_malloc(size);
+    /* returned size includes the terminating null byte */
+    size = JSStringGetUTF8CString(str, ret, size);
+    if (len)
+        *len = size ? size - 1 : 0;
+    return ret;
+}
+
+/* Returns a newly allocated UTF-8 copy of the string value of the given
+ * javascript value or NULL if it couldn't be converted. */
+gchar*
+luaJS_tostring(JSContextRef context, JSValueRef value, size_t *len)
+{
+    JSValueRef exc = NULL;
+    JSStringRef str = JSValueToStringCopy(context, value, &exc);
+    if (!str)
+        return NULL;
+
+    gchar *ret = jsstring_to_utf8(str, len);
+    JSStringRelease(str);
+    return ret;
+}
+
+static JSValueRef
+get_property(JSContextRef context, JSObjectRef obj, const gchar *name)
+{
+    JSStringRef prop = JSStringCreateWithUTF8CString(name);
+    JSValueRef value = JSObjectGetProperty(context, obj, prop, NULL);
+    JSStringRelease(prop);
+    return value;
+}
+
+static gchar*
+get_property_string(JSContextRef context, JSObjectRef obj, const gchar *name)
+{
+    JSValueRef value = get_property(context, obj, name);
+
+    if (!value || JSValueIsUndefined(context, value))
+        return NULL;
+    return luaJS_tostring(context, value, NULL);
+}
+
+/* Returns a newly allocated "file:line: message" description of the given
+ * javascript exception. */
+gchar*
+luaJS_exception_message(JSContextRef context, JSValueRef exc)
+{
+    JSObjectRef obj = JSValueToObject(context, exc, NULL);
+    gchar *msg, *file = NULL, *line = NULL, *ret;
+
+    if (!(msg = luaJS_tostring(context, exc, NULL)))
+        msg = g_strdup("unknown exception");
+
+    if (obj) {
+        file = get_property_string(context, obj, "sourceURL");
+        line = get_property_string(context, obj, "line");
+    }
+
+    ret = g_strdup_printf("%s:%s: %s", file ? file : "(unknown)",
+            line ? line : "?", msg);
+    g_free(file);
+    g_free(line);
+    g_free(msg);
+    return ret;
+}
+
+static gboolean
+is_array(JSContextRef context, JSObjectRef obj)
+{
+    JSValueRef array = get_property(context, JSContextGetGlobalObject(context),
+            "Array");
+
+    return array && JSValueIsObject(context, array)
+        && JSValueIsInstanceOfConstructor(context, obj,
+                JSValueToObject(context, array, NULL), NULL);
+}
+
+/* State of a javascript -> lua conversion. The page controls the converted
+ * value, so besides the depth every conversion is limited in the number of
+ * values and string bytes it produces and objects seen before (cycles or
+ * objects referenced more than once) are converted to nil. */
+typedef struct {
+    JSContextRef context;
+    /* stack index of the set of visited objects (light userdata keys) */
+    gint visited;
+    /* Object.getOwnPropertyDescriptor */
+    JSObjectRef getdesc;
+    guint nodes;
+    size_t bytes;
+    /* set once the conversion failed */
+    const gchar *error;
+} luajs_conv_t;
+
+static void luaJS_convert(lua_State *L, luajs_conv_t *c, JSValueRef value,
+        gint depth);
+
+/* Returns the value of an own data property of the object or NULL for
+ * inherited properties and accessors (which would run page getters) */
+static JSValueRef
+get_own_value(luajs_conv_t *c, JSObjectRef obj, JSStringRef name)
+{
+    if (!c->getdesc)
+        return NULL;
+
+    JSValueRef args[2] = { obj, JSValueMakeString(c->context, name) };
+    JSValueRef desc = JSObjectCallAsFunction(c->context, c->getdesc, NULL,
+            2, args, NULL);
+    JSObjectRef d = (desc && JSValueIsObject(c->context, desc))
+        ? JSValueToObject(c->context, desc, NULL) : NULL;
+    JSStringRef value = JSStringCreateWithUTF8CString("value");
+    JSValueRef ret = NULL;
+    if (d && JSObjectHasProperty(c->context, d, value))
+        ret = JSObjectGetProperty(c->context, d, value, NULL);
+    JSStringRelease(value);
+    return ret;
+}
+
+/* Accounts a converted value, returns FALSE once the budget is spent */
+static gboolean
+luaJS_account(lua_State *L, luajs_conv_t *c)
+{
+    if (c->error)
+        return FALSE;
+    if (++c->nodes > LUAJS_MAX_NODES)
+        c->error = "js value too large";
+    /* not luaL_checkstack, the conversion has to clean up first */
+    else if (!lua_checkstack(L, 3))
+        c->error = "js value nesting too deep";
+    return !c->error;
+}
+
+/* Accounts converted string bytes, returns FALSE once the budget is spent */
+static gboolean
+luaJS_account_bytes(luajs_conv_t *c, size_t bytes)
+{
+    if (!c->error && (c->bytes += bytes) > LUAJS_MAX_BYTES)
+        c->error = "js value too large";
+    return !c->error;
+}
+
+static void
+luaJS_pusharray(lua_State *L, luajs_conv_t *c, JSObjectRef obj, gint depth)
+{
+    JSValueRef length = get_property(c->context, obj, "length");
+
+    /* the page controls the length, it may be anything */
+    gdouble n = length ? JSValueToNumber(c->context, length, NULL) : 0;
+    guint len = (n > 0) ? (guint) MIN(n, LUAJS_MAX_LENGTH) : 0;
+
+    lua_createtable(L, MIN(len, LUAJS_MAX_NODES - c->nodes), 0);
+    for (guint i = 0; i < len && !c->error; i++) {
+        luaJS_convert(L, c,
+                JSObjectGetPropertyAtIndex(c->context, obj, i, NULL), depth);
+        lua_rawseti(L, -2, i + 1);
+    }
+}
+
+static void
+luaJS_pushobject(lua_State *L, luajs_conv_t *c, JSObjectRef obj, gint depth)
+{
+    JSPropertyNameArrayRef names = JSObjectCopyPropertyNames(c->context, obj);
+    size_t count = JSPropertyNameArrayGetCount(names);
+    JSStringRef name;
+    JSValueRef value;
+    gchar *key;
+    size_t len;
+
+    lua_createtable(L, 0, MIN(count, LUAJS_MAX_NODES - c->nodes));
+    for (size_t i = 0; i < count && !c->error; i++) {
+        name = JSPropertyNameArrayGetNameAtIndex(names, i);
+        /* the names include inherited properties */
+        if (!(value = get_own_value(c, obj, name)))
+            continue;
+        key = jsstring_to_utf8(name, &len);
+        if (luaJS_account_bytes(c, len)) {
+            lua_pushlstring(L, key, len);
+            luaJS_convert(L, c, value, depth);
+            lua_rawset(L, -3);
+        }
+        g_free(key);
+    }
+    JSPropertyNameArrayRelease(names);
+}
+
+static void
+luaJS_convert(lua_State *L, luajs_conv_t *c, JSValueRef value, gint depth)
+{
+    gchar *str;
+    size_t len = 0;
+
+    if (!luaJS_account(L, c)) {
+        lua_pushnil(L);
+        return;
+    }
+
+    switch (value ? JSValueGetType(c->context, value) : kJSTypeUndefined) {
+      case kJSTypeBoolean:
+        lua_pushboolean(L, JSValueToBoolean(c->context, value));
+        break;
+
+      case kJSTypeNumber:
+        lua_pushnumber(L, JSValueToNumber(c->context, value, NULL));
+        break;
+
+      case kJSTypeString:
+        str = luaJS_tostring(c->context, value, &len);
+        if (luaJS_account_bytes(c, len))
+            lua_pushlstring(L, NONULL(str), str ? len : 0);
+        else
+            lua_pushnil(L);
+        g_free(str);
+        break;
+
+      case kJSTypeObject:
+        {
+            JSObjectRef obj = JSValueToObject(c->context, value, NULL);
+            if (depth <= 0 || !obj || JSObjectIsFunction(c->context, obj)) {
+                lua_pushnil(L);
+                break;
+            }
+            /* convert each object only once */
+            lua_pushlightuserdata(L, obj);
+            lua_rawget(L, c->visited);
+            gboolean seen = lua_toboolean(L, -1);
+            lua_pop(L, 1);
+            if (seen) {
+                lua_pushnil(L);
+                break;
+            }
+            lua_pushlightuserdata(L, obj);
+            lua_pushboolean(L, TRUE);
+            lua_rawset(L, c->visited);
+
+            if (is_array(c->context, obj))
+                luaJS_pusharray(L, c, obj, depth - 1);
+            else
+                luaJS_pushobject(L, c, obj, depth - 1);
+        }
+        break;
+
+      default:
+        lua_pushnil(L);
+        break;
+    }
+}
+
+/* Pushes the lua equivalent of the given javascript value. Arrays and
+ * objects are converted to tables up to `depth` levels deep, deeper values,
+ * functions and objects already converted are converted to nil, only own
+ * data properties of objects are converted. Raises an error if the value
+ * exceeds LUAJS_MAX_NODES values or LUAJS_MAX_BYTES string bytes. */
+gint
+luaJS_pushvalue(lua_State *L, JSContextRef context, JSValueRef value, gint depth)
+{
+    luaL_checkstack(L, 4, "js value nesting too deep");
+
+    luajs_conv_t c = { .context = context };
+    JSValueRef object = get_property(context,
+            JSContextGetGlobalObject(context), "Object");
+    JSObjectRef ctor = (object && JSValueIsObject(context, object))
+        ? JSValueToObject(context, object, NULL) : NULL;
+    JSValueRef getdesc = ctor
+        ? get_property(context, ctor, "getOwnPropertyDescriptor") : NULL;
+    if (getdesc && JSValueIsObject(context, getdesc))
+        c.getdesc = JSValueToObject(context, getdesc, NULL);
+
+    lua_newtable(L);
+    c.visited = lua_gettop(L);
+    luaJS_convert(L, &c, value, MIN(depth, LUAJS_DEPTH_LIMIT));
+    lua_remove(L, c.visited);
+
+    if (c.error) {
+        lua_pop(L, 1);
+        luaL_error(L, "%s", c.error);
+    }
+    return 1;
+}
+
+static JSValueRef
+luaJS_makestring(JSContextRef context, const gchar *str)
+{
+    JSStringRef js_str = JSStringCreateWithUTF8CString(str);
+    JSValueRef ret = JSValueMakeString(context, js_str);
+    JSStringRelease(js_str);
+    return ret;
+}
+
+/* Returns TRUE if the table at idx is a (non-empty) sequence */
+static gboolean
+is_sequence(lua_State *L, gint idx)
+{
+    size_t len = lua_objlen(L, idx), count = 0;
+    if (!len)
+        return FALSE;
+
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+        count++;
+        lua_pop(L, 1);
+    }
+    return count == len;
+}
+
+static JSValueRef
+luaJS_totable(lua_State *L, JSContextRef context, gint idx, gint depth)
+{
+    luaL_checkstack(L, 3, "lua table nesting too deep");
+
+    if (is_sequence(L, idx)) {
+        size_t len = lua_objlen(L, idx);
+        /* the garbage collector doesn't see the heap allocated items,
+         * protect them until they are in the array */
+        JSValueRef *items = g_new(JSValueRef, len);
+        for (size_t i = 0; i < len; i++) {
+            lua_rawgeti(L, idx, i + 1);
+            items[i] = luaJS_tovalue(L, context, -1, depth);
+            JSValueProtect(context, items[i]);
+            lua_pop(L, 1);
+        }
+        JSObjectRef array = JSObjectMakeArray(context, len, items, NULL);
+        for (size_t i = 0; i < len; i++)
+            JSValueUnprotect(context, items[i]);
+        g_free(items);
+        return array;
+    }
+
+    JSObjectRef obj = JSObjectMake(context, NULL, NULL);
+    JSStringRef name;
+
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+        /* only string & number keys have a javascript equivalent, use a
+         * copy of the key as lua_tostring changes numbers in place */
+        if (lua_type(L, -2) == LUA_TSTRING || lua_type(L, -2) == LUA_TNUMBER) {
+            lua_pushvalue(L, -2);
+            name = JSStringCreateWithUTF8CString(lua_tostring(L, -1));
+            lua_pop(L, 1);
+            JSObjectSetProperty(context, obj, name,
+                    luaJS_tovalue(L, context, -1, depth),
+                    kJSPropertyAttributeNone, NULL);
+            JSStringRelease(name);
+        }
+        lua_pop(L, 1);
+    }
+    return obj;
+}
+
+/* Returns the javascript equivalent of the lua value at the given index.
+ * Tables are converted to arrays (sequences) or objects up to `depth` levels
+ * deep, deeper tables and values without equivalent (functions, userdata)
+ * are converted to undefined. */
+JSValueRef
+luaJS_tovalue(lua_State *L, JSContextRef context, gint idx, gint depth)
+{
+    /* correct relative index */
+    if (idx < 0)
+        idx = lua_gettop(L) + idx + 1;
+
+    depth = MIN(depth, LUAJS_DEPTH_LIMIT);
+
+    switch (lua_type(L, idx)) {
+      case LUA_TNIL:
+        return JSValueMakeNull(context);
+
+      case LUA_TBOOLEAN:
+        return JSValueMakeBoolean(context, lua_toboolean(L, idx));
+
+      case LUA_TNUMBER:
+        return JSValueMakeNumber(context, lua_tonumber(L, idx));
+
+      case LUA_TSTRING:
+        return luaJS_makestring(context, lua_tostring(L, idx));
+
+      case LUA_TTABLE:
+        if (depth > 0)
+            return luaJS_totable(L, context, idx, depth - 1);
+        /* fall through */
+
+      default:
+        return JSValueMakeUndefined(context);
+    }
+}
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
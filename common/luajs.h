@@ -0,0 +1,45 @@
+/*
+ * common/luajs.h - javascript <-> lua value conversion
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LUAKIT_COMMON_LUAJS_H
+#define LUAKIT_COMMON_LUAJS_H
+
+#include <JavaScriptCore/JavaScript.h>
+#include <glib.h>
+#include <lua.h>
+
+/* default nesting limit of converted objects & arrays */
+#define LUAJS_MAX_DEPTH 16
+/* nesting limit callers can't raise the limit above */
+#define LUAJS_DEPTH_LIMIT 64
+/* arrays longer than this are truncated */
+#define LUAJS_MAX_LENGTH 100000
+/* number of values & string bytes a single conversion may produce */
+#define LUAJS_MAX_NODES 100000
+#define LUAJS_MAX_BYTES (16 * 1024 * 1024)
+
+gchar *luaJS_tostring(JSContextRef context, JSValueRef value, size_t *len);
+gchar *luaJS_exception_message(JSContextRef context, JSValueRef exc);
+gint luaJS_pushvalue(lua_State *L, JSContextRef context, JSValueRef value, gint depth);
+JSValueRef luaJS_tovalue(lua_State *L, JSContextRef context, gint idx, gint depth);
+
+#endif
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
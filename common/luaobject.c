@@ -20,6 +20,7 @@
  */
 
 #include "common/luaobject.h"
+#include "common/watchdog.h"
 
 /* Setup the object system at startup. */
 void
@@ -190,6 +191,9 @@ signal_object_emit(lua_State *L, signal_t *signals,
         gint nbfunc = sigfuncs->len;
         luaL_checkstack(L, lua_gettop(L) + nbfunc + nargs + 1,
                 "too much signal");
+        /* let the watchdog know which signal is running */
+        const gchar *prev_signal = watchdog_signal;
+        watchdog_signal = name;
         /* Push all functions and then execute, because this list can change
          * while executing funcs. */
         for(gint i = 0; i < nbfunc; i++) {
@@ -227,6 +231,7 @@ signal_object_emit(lua_State *L, signal_t *signals,
                     }
                 }
 
+                watchdog_signal = prev_signal;
                 /* Return the number of returned arguments */
                 return ret;
             } else if (nret == 0) {
@@ -234,6 +239,7 @@ signal_object_emit(lua_State *L, signal_t *signals,
                 lua_pop(L, ret);
             }
         }
+        watchdog_signal = prev_signal;
     }
     /* remove args */
     lua_pop(L, nargs);
@@ -265,6 +271,9 @@ luaH_object_emit_signal(lua_State *L, gint oud,
     if(sigfuncs) {
         guint nbfunc = sigfuncs->len;
         luaL_checkstack(L, lua_gettop(L) + nbfunc + nargs + 2, "too much signal");
+        /* let the watchdog know which signal is running */
+        const gchar *prev_signal = watchdog_signal;
+        watchdog_signal = name;
         /* Push all functions and then execute, because this list can change
          * while executing funcs. */
         for(guint i = 0; i < nbfunc; i++)
@@ -300,6 +309,7 @@ luaH_object_emit_signal(lua_State *L, gint oud,
                 /* Remove all signal functions and args from the stack */
                 for (gint i = bot; i <= top; i++)
                     lua_remove(L, bot);
+                watchdog_signal = prev_signal;
                 /* Return the number of returned arguments */
                 return ret;
             } else if (nret == 0) {
@@ -307,6 +317,7 @@ luaH_object_emit_signal(lua_State *L, gint oud,
                 lua_pop(L, ret);
             }
         }
+        watchdog_signal = prev_signal;
     }
     lua_pop(L, nargs);
     return 0;
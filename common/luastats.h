@@ -0,0 +1,50 @@
+/*
+ * common/luastats.h - helpers for pushing statistics tables
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LUAKIT_COMMON_LUASTATS_H
+#define LUAKIT_COMMON_LUASTATS_H
+
+#include <glib/gtypes.h>
+#include <lua.h>
+
+/* Milliseconds between two g_get_monotonic_time() timestamps */
+#define ELAPSED_MS(start, end) (((end) - (start)) / 1000.0)
+
+/* Sets t[name] = value on the table on top of the stack */
+static inline void
+luaH_pushnumfield(lua_State *L, const gchar *name, lua_Number value)
+{
+    lua_pushstring(L, name);
+    lua_pushnumber(L, value);
+    lua_rawset(L, -3);
+}
+
+/* Sets t[name] to the milliseconds between the two timestamps on the table
+ * on top of the stack, phases which haven't started or ended are left out. */
+static inline void
+luaH_pushelapsedfield(lua_State *L, const gchar *name, gint64 start, gint64 end)
+{
+    if (start && end)
+        luaH_pushnumfield(L, name, ELAPSED_MS(start, end));
+}
+
+#endif
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
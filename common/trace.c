@@ -0,0 +1,147 @@
+/*
+ * common/trace.c - startup tracing
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common/trace.h"
+#include "common/util.h"
+
+#include <glib.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Startup spans are recorded as begin/end events of the Chrome trace event
+ * format, the resulting file can be opened with chrome://tracing or Perfetto.
+ * Tracing stops and the file is written once the first page has been painted
+ * (or failed to load), or at exit if that never happens. All functions must
+ * be called from the main thread and do nothing if tracing is disabled. */
+
+static struct {
+    /* file to write the trace to (NULL when not tracing) */
+    gchar *file;
+    /* monotonic time (in µs) luakit was started at */
+    gint64 start;
+    /* process id, also used as the thread id of the main thread */
+    gint pid;
+    /* the events recorded so far */
+    GString *events;
+} trace;
+
+static void
+trace_append_string(GString *s, const gchar *str)
+{
+    g_string_append_c(s, '"');
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            g_string_append_printf(s, "\\%c", *str);
+        else if ((guchar) *str < 0x20)
+            g_string_append_printf(s, "\\u%04x", (guchar) *str);
+        else
+            g_string_append_c(s, *str);
+    }
+    g_string_append_c(s, '"');
+}
+
+static void
+trace_event(const gchar *ph, const gchar *cat, const gchar *name)
+{
+    if (!trace.file)
+        return;
+
+    gint64 ts = g_get_monotonic_time() - trace.start;
+    g_string_append(trace.events, ",\n{\"name\":");
+    trace_append_string(trace.events, name);
+    g_string_append(trace.events, ",\"cat\":");
+    trace_append_string(trace.events, cat);
+    g_string_append_printf(trace.events, ",\"ph\":\"%s\",\"ts\":%"
+            G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%d", ph, ts, trace.pid,
+            trace.pid);
+    /* instant events are drawn across the whole process */
+    if (*ph == 'i')
+        g_string_append(trace.events, ",\"s\":\"p\"");
+    g_string_append_c(trace.events, '}');
+}
+
+gboolean
+trace_enabled(void)
+{
+    return trace.file != NULL;
+}
+
+void
+trace_begin(const gchar *cat, const gchar *name)
+{
+    trace_event("B", cat, name);
+}
+
+void
+trace_end(const gchar *cat, const gchar *name)
+{
+    trace_event("E", cat, name);
+}
+
+void
+trace_instant(const gchar *cat, const gchar *name)
+{
+    trace_event("i", cat, name);
+}
+
+/* Writes the trace and stops tracing */
+void
+trace_write(void)
+{
+    GError *e = NULL;
+
+    if (!trace.file)
+        return;
+
+    g_string_append(trace.events, "\n]}\n");
+    if (g_file_set_contents(trace.file, trace.events->str, trace.events->len, &e))
+        debug("wrote startup trace to %s", trace.file);
+    else {
+        warn("unable to write startup trace: %s", e->message);
+        g_clear_error(&e);
+    }
+
+    g_string_free(trace.events, TRUE);
+    g_free(trace.file);
+    trace.events = NULL;
+    trace.file = NULL;
+}
+
+/* Starts tracing to the given file (if not NULL). Timestamps are relative to
+ * `start` (the monotonic time luakit was started at). */
+void
+trace_init(const gchar *file, gint64 start)
+{
+    if (!file || trace.file)
+        return;
+
+    trace.file = g_strdup(file);
+    trace.start = start;
+    trace.pid = getpid();
+    trace.events = g_string_new("{\"traceEvents\":[\n");
+    g_string_append_printf(trace.events, "{\"name\":\"process_name\","
+            "\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"luakit\"}}",
+            trace.pid);
+
+    /* luakit may exit before a page is shown */
+    atexit(trace_write);
+}
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
@@ -0,0 +1,35 @@
+/*
+ * common/trace.h - startup tracing
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LUAKIT_COMMON_TRACE_H
+#define LUAKIT_COMMON_TRACE_H
+
+#include <glib/gtypes.h>
+
+void trace_init(const gchar *file, gint64 start);
+gboolean trace_enabled(void);
+void trace_begin(const gchar *cat, const gchar *name);
+void trace_end(const gchar *cat, const gchar *name);
+void trace_instant(const gchar *cat, const gchar *name);
+void trace_write(void);
+
+#endif
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
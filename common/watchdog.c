@@ -0,0 +1,259 @@
+/*
+ * common/watchdog.c - main loop stall watchdog
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common/luaobject.h"
+#include "clib/luakit.h"
+#include "common/util.h"
+#include "common/watchdog.h"
+#include "globalconf.h"
+
+#include <glib.h>
+#include <lauxlib.h>
+
+/* The main loop is considered busy from the moment poll() returns until it is
+ * called again. A watchdog thread sleeps while the main loop is idle and
+ * checks on it `threshold` ms after each dispatch started. If that dispatch
+ * is still running the watchdog thread arms the lua count hook, which grabs a
+ * traceback of whatever lua code runs next (i.e. the stuck handler), and once
+ * the main loop recovers the stall is reported from the main thread.
+ *
+ * Lua hooks are per thread (coroutine), the hook is installed on the main
+ * state and on every coroutine before it is resumed (see watchdog_attach),
+ * coroutines created from lua inherit it. The hook is only ever installed
+ * from the main thread, the watchdog thread just sets the `armed` flag.
+ * Hooks set with debug.sethook are left alone (their threads aren't
+ * watched). Note that while a count hook is set LuaJIT doesn't compile new
+ * traces, which is why the watchdog is off by default. */
+
+/* number of lua instructions between checks of the `armed` flag */
+#define WATCHDOG_HOOK_COUNT 1000
+
+const gchar *watchdog_signal = NULL;
+
+static struct {
+    /* protects all fields below up to `stalled` */
+    GMutex *lock;
+    GCond *cond;
+    /* stall threshold in ms */
+    guint threshold;
+    /* main loop is currently dispatching */
+    gboolean dispatching;
+    /* monotonic time (in µs) the current dispatch started at */
+    gint64 dispatch_start;
+    /* incremented at the start of each dispatch */
+    guint generation;
+    /* watchdog thread waits for the main loop to wake up */
+    gboolean waiting;
+    /* the current dispatch has been reported as stalled */
+    gboolean stalled;
+    /* the hook should grab a traceback (accessed atomically) */
+    gint armed;
+
+    /* the following are only touched from the main thread */
+    gchar *traceback;
+    gchar *signame;
+    /* stall counts by signal name */
+    GHashTable *counts;
+} wd;
+
+static gchar*
+watchdog_traceback(lua_State *L)
+{
+    GString *tb = g_string_new("stack traceback:");
+    lua_Debug ar;
+
+    for (gint level = 0; lua_getstack(L, level, &ar); level++) {
+        lua_getinfo(L, "Snl", &ar);
+        g_string_append_printf(tb, "\n\t%s:", ar.short_src);
+        if (ar.currentline > 0)
+            g_string_append_printf(tb, "%d:", ar.currentline);
+        if (ar.name && *ar.name)
+            g_string_append_printf(tb, " in function '%s'", ar.name);
+        else if (*ar.what == 'm')
+            g_string_append(tb, " in main chunk");
+        else if (*ar.what == 'C')
+            g_string_append(tb, " ?");
+        else
+            g_string_append_printf(tb, " in function <%s:%d>",
+                    ar.short_src, ar.linedefined);
+    }
+    return g_string_free(tb, FALSE);
+}
+
+/* Runs in the main thread every WATCHDOG_HOOK_COUNT instructions, grabs a
+ * traceback once the watchdog thread noticed a stall */
+static void
+watchdog_hook(lua_State *L, lua_Debug *ar)
+{
+    (void) ar;
+    if (!g_atomic_int_get(&wd.armed))
+        return;
+    g_atomic_int_set(&wd.armed, FALSE);
+
+    g_free(wd.traceback);
+    g_free(wd.signame);
+    wd.traceback = watchdog_traceback(L);
+    wd.signame = g_strdup(watchdog_signal);
+}
+
+static gboolean
+watchdog_report_cb(gpointer data)
+{
+    lua_State *L = globalconf.L;
+    guint ms = GPOINTER_TO_UINT(data);
+    const gchar *key = wd.signame ? wd.signame : "(none)";
+
+    warn("main loop stalled for %ums while emitting \"%s\"\n%s", ms, key,
+            wd.traceback ? wd.traceback : "no lua code was running");
+
+    guint n = GPOINTER_TO_UINT(g_hash_table_lookup(wd.counts, key));
+    g_hash_table_insert(wd.counts, g_strdup(key), GUINT_TO_POINTER(n + 1));
+
+    lua_pushnumber(L, ms);
+    if (wd.signame)
+        lua_pushstring(L, wd.signame);
+    else
+        lua_pushnil(L);
+    if (wd.traceback)
+        lua_pushstring(L, wd.traceback);
+    else
+        lua_pushnil(L);
+    signal_object_emit(L, luakit_class.signals, "debug::stall", 3, 0);
+
+    g_free(wd.traceback);
+    g_free(wd.signame);
+    wd.traceback = wd.signame = NULL;
+    return FALSE;
+}
+
+static gint
+watchdog_poll(GPollFD *fds, guint nfds, gint timeout)
+{
+    g_mutex_lock(wd.lock);
+    wd.dispatching = FALSE;
+    if (wd.stalled) {
+        /* the hook must not fire in a later (unrelated) dispatch */
+        g_atomic_int_set(&wd.armed, FALSE);
+        g_cond_signal(wd.cond);
+    }
+    g_mutex_unlock(wd.lock);
+
+    gint ret = g_poll(fds, nfds, timeout);
+
+    g_mutex_lock(wd.lock);
+    wd.dispatching = TRUE;
+    wd.dispatch_start = g_get_monotonic_time();
+    wd.generation++;
+    if (wd.waiting)
+        g_cond_signal(wd.cond);
+    g_mutex_unlock(wd.lock);
+
+    return ret;
+}
+
+static gpointer
+watchdog_thread(gpointer data)
+{
+    (void) data;
+    GTimeVal tv;
+
+    g_mutex_lock(wd.lock);
+    while (TRUE) {
+        /* sleep until the main loop has work to do */
+        while (!wd.dispatching) {
+            wd.waiting = TRUE;
+            g_cond_wait(wd.cond, wd.lock);
+            wd.waiting = FALSE;
+        }
+
+        gint64 left = wd.dispatch_start + wd.threshold * 1000
+            - g_get_monotonic_time();
+        if (left > 0) {
+            g_get_current_time(&tv);
+            g_time_val_add(&tv, left);
+            g_cond_timed_wait(wd.cond, wd.lock, &tv);
+            continue;
+        }
+
+        /* the dispatch is taking too long, ask lua where it is */
+        guint generation = wd.generation;
+        gint64 start = wd.dispatch_start;
+        wd.stalled = TRUE;
+        g_atomic_int_set(&wd.armed, TRUE);
+
+        while (wd.dispatching && wd.generation == generation)
+            g_cond_wait(wd.cond, wd.lock);
+        wd.stalled = FALSE;
+
+        guint ms = (g_get_monotonic_time() - start) / 1000;
+        g_idle_add(watchdog_report_cb, GUINT_TO_POINTER(ms));
+    }
+    return NULL;
+}
+
+gint
+luaH_watchdog_push_stats(lua_State *L)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    lua_newtable(L);
+    if (!wd.counts)
+        return 1;
+
+    g_hash_table_iter_init(&iter, wd.counts);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        lua_pushstring(L, key);
+        lua_pushnumber(L, GPOINTER_TO_UINT(value));
+        lua_rawset(L, -3);
+    }
+    return 1;
+}
+
+/* Installs the stall hook on a coroutine (unless it has a hook already),
+ * must be called (from the main thread) before resuming coroutines created
+ * from C. */
+void
+watchdog_attach(lua_State *L)
+{
+    if (wd.lock && !lua_gethook(L))
+        lua_sethook(L, watchdog_hook, LUA_MASKCOUNT, WATCHDOG_HOOK_COUNT);
+}
+
+/* Start watching the default main context. Must be called after the thread
+ * system has been initialised. A threshold of 0 disables the watchdog. */
+void
+watchdog_init(guint threshold)
+{
+    if (!threshold || wd.lock)
+        return;
+
+    wd.threshold = threshold;
+    wd.lock = g_mutex_new();
+    wd.cond = g_cond_new();
+    wd.counts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    watchdog_attach(globalconf.L);
+    g_main_context_set_poll_func(NULL, watchdog_poll);
+    if (!g_thread_create(watchdog_thread, NULL, FALSE, NULL))
+        fatal("unable to start watchdog thread");
+}
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
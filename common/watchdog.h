@@ -0,0 +1,36 @@
+/*
+ * common/watchdog.h - main loop stall watchdog
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LUAKIT_COMMON_WATCHDOG_H
+#define LUAKIT_COMMON_WATCHDOG_H
+
+#include <glib/gtypes.h>
+#include <lua.h>
+
+/* name of the signal currently being emitted (main thread only) */
+extern const gchar *watchdog_signal;
+
+void watchdog_init(guint threshold);
+void watchdog_attach(lua_State *L);
+gint luaH_watchdog_push_stats(lua_State *L);
+
+#endif
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
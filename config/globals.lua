@@ -44,6 +44,17 @@ soup.set_property("ssl-strict", false)
 cookie_policy = { always = 0, never = 1, no_third_party = 2 }
 soup.set_property("accept-policy", cookie_policy.always)
 
+-- Resolve (and with `preconnect` also connect to) the hosts of hovered links
+-- and typed :open addresses before they are requested.
+soup.set_prefetch{ enabled = true, preconnect = false, rate = 4, burst = 8 }
+
+-- Per-domain request header rules, rules apply to the domain and all of its
+-- subdomains ("*" for every domain). A value of false removes the header.
+--soup.set_header_rules{
+--    ["*"]           = { DNT = "1" },
+--    ["example.com"] = { ["User-Agent"] = "Mozilla/5.0", Referer = false },
+--}
+
 -- List of search engines. Each item must contain a single %s which is
 -- replaced by URI encoded search terms. All other occurances of the percent
 -- character (%) may need to be escaped by placing another % before or after
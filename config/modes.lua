@@ -110,6 +110,20 @@ new_mode("passthrough", {
     reset_on_navigation = false,
 })
 
+-- Warms up the destination of open commands once the user stopped typing
+-- (the input changes with every key, partial hostnames shouldn't be looked up)
+local prefetch = { timer = timer{interval = 300} }
+prefetch.timer:add_signal("timeout", function (t)
+    t:stop()
+    soup.prefetch(prefetch.w:search_open(prefetch.arg), false)
+    prefetch.w, prefetch.arg = nil, nil
+end)
+
+local function prefetch_cancel()
+    if prefetch.timer.started then prefetch.timer:stop() end
+    prefetch.w, prefetch.arg = nil, nil
+end
+
 -- Setup command mode
 new_mode("command", {
     enter = function (w)
@@ -118,7 +132,17 @@ new_mode("command", {
     end,
     changed = function (w, text)
         -- Auto-exit command mode if user backspaces ":" in the input bar.
-        if not string.match(text, "^:") then w:set_mode() end
+        if not string.match(text, "^:") then w:set_mode() return end
+        -- Warm up the destination of open commands after a pause in typing
+        prefetch_cancel()
+        local cmd, arg = string.match(text, "^:(%a+)%s+(%S+%.%a%a+)$")
+        if cmd and string.match(cmd, "open$") then
+            prefetch.w, prefetch.arg = w, arg
+            prefetch.timer:start()
+        end
+    end,
+    leave = function (w)
+        prefetch_cancel()
     end,
     activate = function (w, text)
         w:set_mode()
@@ -85,6 +85,10 @@ require "search"
 -- Add ordering of new tabs
 require "taborder"
 
+-- Discard the pages of tabs which haven't been looked at in a while, off
+-- until tabdiscard.timeout is set to a number of minutes
+require "tabdiscard"
+
 -- Save web history
 require "history"
 require "history_chrome"
@@ -679,19 +679,22 @@ window.methods = {
             table.insert(args, string.format("-c %q", conf))
         end
 
-        -- Check config has valid syntax
+        -- Check config has valid syntax (without blocking the ui)
         local cmd = table.concat(args, " ")
-        if luakit.spawn_sync(cmd .. " -k") ~= 0 then
-            return w:error("Cannot restart, syntax error in configuration file"..((conf and ": "..conf) or "."))
-        end
+        async.run(function ()
+            local reason, status = async.spawn(cmd .. " -k")
+            if reason ~= "exit" or status ~= 0 then
+                return w:error("Cannot restart, syntax error in configuration file"..((conf and ": "..conf) or "."))
+            end
 
-        -- Save session.
-        local wins = {}
-        for _, w in pairs(window.bywidget) do table.insert(wins, w) end
-        session.save(wins)
+            -- Save session.
+            local wins = {}
+            for _, w in pairs(window.bywidget) do table.insert(wins, w) end
+            session.save(wins)
 
-        -- Replace current process with new luakit instance.
-        luakit.exec(cmd)
+            -- Replace current process with new luakit instance.
+            luakit.exec(cmd)
+        end)
     end,
 
     -- Intelligent open command which can detect a uri or search argument.
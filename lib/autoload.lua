@@ -0,0 +1,364 @@
+------------------------------------------------------------
+-- Load library modules on first use                      --
+-- © 2011 Mason Larobina <mason.larobina@gmail.com>       --
+------------------------------------------------------------
+
+-- This module is loaded before the rc.lua runs and hooks the modules listed
+-- in `modules` into package.preload. When one of them is required it isn't
+-- loaded, instead lightweight stubs are registered for the binds, commands,
+-- chrome pages, methods and signals its manifest (e.g. follow_manifest.lua
+-- next to follow.lua) says the module provides. The first time a
+-- stub is used the real module is loaded (its binds take the place of the
+-- stubs) and whatever triggered the stub is run again.
+--
+-- Modules which are found in the users config dir are loaded as usual (they
+-- may provide something else). To always load a module straight away remove
+-- it from the list before requiring it:
+--
+--   autoload.modules.follow = nil
+--   require "follow"
+
+-- Get lua environment
+local _G = _G
+local package = package
+local string = string
+local table = table
+local ipairs = ipairs
+local pairs = pairs
+local warn = warn
+local type = type
+local error = error
+local assert = assert
+local pcall = pcall
+local select = select
+local unpack = unpack
+local rawget = rawget
+local rawset = rawset
+local setmetatable = setmetatable
+local require = require
+
+-- Get luakit environment
+local capi = { luakit = luakit }
+
+module("autoload")
+
+--- The modules to autoload. What each of them provides is declared in a
+-- manifest next to the module (`<name>_manifest.lua`, returning a table) or
+-- given here as a table instead of `true`. Binds are given per mode as
+-- `{ "key", mods, key }` or `{ "buf", pattern }`, commands in the form
+-- `lousy.bind.cmd` takes them, chrome pages by their pattern, methods per
+-- class (webview or window) and signals per library (e.g. soup). `module` is
+-- the name the module passes to `module()`, a placeholder table which loads
+-- the module when it is used is put there until then.
+modules = {
+    follow = true,
+    formfiller = true,
+    quickmarks = true,
+    undoclose = true,
+    tabhistory = true,
+    bookmarks = true,
+    downloads_chrome = true,
+    history_chrome = true,
+}
+
+-- State of each module: "stubbed", "loading" or "loaded"
+local state = {}
+-- Functions removing the (non-bind) stubs of each module
+local stubs = {}
+-- Placeholder tables of each module
+local proxies = {}
+-- Declarations (manifests) of the stubbed modules
+local decls = {}
+-- Handlers each module added for its stubbed signals while it was loaded,
+-- by library and signal name
+local handlers = {}
+
+-- Returns the loader require would use if package.preload didn't have one
+local function find_loader(name)
+    local msg = {}
+    for i, searcher in ipairs(package.loaders) do
+        if i > 1 then
+            local loader = searcher(name)
+            if type(loader) == "function" then return loader end
+            if type(loader) == "string" then table.insert(msg, loader) end
+        end
+    end
+    error(string.format("module '%s' not found:%s", name, table.concat(msg)))
+end
+
+-- Returns true if the module would be loaded from the users config dir
+local function overridden(name)
+    local file = package.findmodule(name)
+    local config_dir = capi.luakit.config_dir
+    return file ~= nil and string.sub(file, 1, #config_dir) == config_dir
+end
+
+-- Returns the number of arguments and a table holding them
+local function pack(...)
+    return select("#", ...), {...}
+end
+
+-- Sets a (dotted) global name like `module()` does
+local function setfield(path, value)
+    local t = _G
+    for part, dot in string.gmatch(path, "([^%.]+)(%.?)") do
+        if dot == "" then
+            t[part] = value
+        else
+            if type(t[part]) ~= "table" then t[part] = {} end
+            t = t[part]
+        end
+    end
+end
+
+-- Returns the set of modes a module has bind stubs in
+local function stub_modes(decl)
+    local modes = {}
+    for mode in pairs(decl.binds or {}) do modes[mode] = true end
+    if decl.cmds then modes.command = true end
+    return modes
+end
+
+-- Returns true if the bind added by a module has a stub in `stubs`
+local function stubbed(b, stubs)
+    for _, s in ipairs(stubs) do
+        if b.type == s.type then
+            if b.type == "key" and b.key == s.key
+                and table.concat(b.mods, "-") == table.concat(s.mods, "-") then
+                return true
+            elseif b.type == "buffer" and b.pattern == s.pattern then
+                return true
+            elseif b.type == "command" then
+                for _, c in ipairs(b.cmds) do
+                    for _, sc in ipairs(s.cmds) do
+                        if c == sc then return true end
+                    end
+                end
+            end
+        end
+    end
+    return false
+end
+
+-- Moves the binds the module added (i.e. the ones not in `old`) to where
+-- its stubs were in the mode and removes the stubs. Warns about binds which
+-- had no stub (their manifest is out of date).
+local function splice(mode, old, name)
+    local binds = _G.get_mode(mode).binds or {}
+    local added, stubs, pos = {}, {}, nil
+    for i = #binds, 1, -1 do
+        local b = binds[i]
+        if b.autoload == name then
+            table.insert(stubs, table.remove(binds, i))
+            pos = i
+        elseif not old[b] then
+            table.insert(added, 1, table.remove(binds, i))
+            if pos then pos = pos - 1 end
+        end
+    end
+    pos = pos or #binds + 1
+    for i, b in ipairs(added) do
+        table.insert(binds, pos + i - 1, b)
+        if b.type ~= "any" and not stubbed(b, stubs) then
+            warn("(autoload.lua): %s added a %s bind to %s mode without a stub "
+                .. "(%s)", name, b.type, mode, b.pattern or b.key
+                or table.concat(b.cmds or {}, ","))
+        end
+    end
+end
+
+--- Loads an autoloaded module (if it hasn't been loaded yet).
+-- @param name The module name as given to `require`.
+function load(name)
+    if not state[name] then
+        require(name)
+    end
+    if state[name] ~= "stubbed" then return end
+    state[name] = "loading"
+
+    local decl = decls[name]
+    for _, remove in ipairs(stubs[name]) do remove() end
+    if proxies[name] then setmetatable(proxies[name], nil) end
+
+    -- Remember which binds were there before the module was loaded
+    local old = {}
+    for mode in pairs(stub_modes(decl)) do
+        old[mode] = {}
+        for _, b in ipairs(_G.get_mode(mode).binds or {}) do
+            old[mode][b] = true
+        end
+    end
+
+    -- Record the handlers the module adds for its stubbed signals
+    local added, add_signal = {}, {}
+    for lib, signames in pairs(decl.signals or {}) do
+        local t = _G[lib]
+        local add = t.add_signal
+        added[lib], add_signal[t] = {}, add
+        for _, signame in ipairs(signames) do added[lib][signame] = {} end
+        rawset(t, "add_signal", function (signame, func, ...)
+            if added[lib][signame] then
+                table.insert(added[lib][signame], func)
+            end
+            return add(signame, func, ...)
+        end)
+    end
+    handlers[name] = added
+
+    local ok, err = pcall(function () find_loader(name)(name) end)
+
+    for t, add in pairs(add_signal) do rawset(t, "add_signal", add) end
+    for mode, binds in pairs(old) do splice(mode, binds, name) end
+    state[name] = "loaded"
+    if not ok then error(err, 0) end
+end
+
+-- Stubs for binds and commands load the module and then match the binds of
+-- the mode again.
+local function bind_stub(name, mode, spec)
+    local bind = require "lousy.bind"
+    local b
+    if spec[1] == "key" then
+        b = bind.key(spec[2], spec[3], function (w, opts)
+            load(name)
+            w:update_binds(mode)
+            return bind.match_key(w, w.binds, opts.mods, opts.key, opts)
+        end)
+    elseif spec[1] == "buf" then
+        b = bind.buf(spec[2], function (w, buffer, opts)
+            load(name)
+            w:update_binds(mode)
+            return bind.match_buf(w, w.binds, buffer, opts)
+        end)
+    else
+        error("invalid autoload bind type: " .. spec[1])
+    end
+    b.autoload = name
+    return b
+end
+
+local function cmd_stub(name, spec)
+    local bind = require "lousy.bind"
+    local b = bind.cmd(spec, function (w, arg, opts)
+        load(name)
+        return bind.match_cmd(w, _G.get_mode("command").binds, opts.cmd, opts)
+    end)
+    b.autoload = name
+    return b
+end
+
+local function chrome_stub(name, pat)
+    local chrome = require "chrome"
+    local function stub(view, uri)
+        load(name)
+        local func = chrome.get(pat)
+        if func and func ~= stub then return func(view, uri) end
+        return false
+    end
+    chrome.add(pat, stub)
+    return function () chrome.del(pat) end
+end
+
+local function method_stub(name, class, method)
+    local methods = _G[class].methods
+    local function stub(...)
+        load(name)
+        local func = methods[method]
+        assert(func and func ~= stub, "module " .. name .. " has no method " .. method)
+        return func(...)
+    end
+    methods[method] = stub
+    return function ()
+        if methods[method] == stub then methods[method] = nil end
+    end
+end
+
+-- Signal stubs call the handlers the module added for the signal once it
+-- is loaded (they aren't part of the emission the stub runs in). Like an
+-- emission this stops at the first handler returning something.
+local function signal_stub(name, lib, signame)
+    local t = _G[lib]
+    local function stub(...)
+        load(name)
+        local added = handlers[name] and handlers[name][lib] or {}
+        for _, func in ipairs(added[signame] or {}) do
+            local n, ret = pack(func(...))
+            if n > 0 then return unpack(ret, 1, n) end
+        end
+    end
+    t.add_signal(signame, stub)
+    return function () t.remove_signal(signame, stub) end
+end
+
+-- Registers the stubs of a module, returns its placeholder table
+local function register(name, decl)
+    local removers = {}
+
+    for mode, specs in pairs(decl.binds or {}) do
+        local binds = {}
+        for _, spec in ipairs(specs) do
+            table.insert(binds, bind_stub(name, mode, spec))
+        end
+        _G.add_binds(mode, binds)
+    end
+
+    if decl.cmds then
+        local cmds = {}
+        for _, spec in ipairs(decl.cmds) do
+            table.insert(cmds, cmd_stub(name, spec))
+        end
+        _G.add_cmds(cmds)
+    end
+
+    for _, pat in ipairs(decl.chrome or {}) do
+        table.insert(removers, chrome_stub(name, pat))
+    end
+
+    for class, methods in pairs(decl.methods or {}) do
+        for _, method in ipairs(methods) do
+            table.insert(removers, method_stub(name, class, method))
+        end
+    end
+
+    for lib, signames in pairs(decl.signals or {}) do
+        for _, signame in ipairs(signames) do
+            table.insert(removers, signal_stub(name, lib, signame))
+        end
+    end
+
+    stubs[name] = removers
+    decls[name] = decl
+    state[name] = "stubbed"
+
+    if not decl.module then return true end
+
+    -- The placeholder becomes the module table once `module()` is called
+    local proxy = setmetatable({}, {
+        __index = function (t, k)
+            load(name)
+            return rawget(t, k)
+        end,
+        __newindex = function (t, k, v)
+            load(name)
+            rawset(t, k, v)
+        end,
+    })
+    proxies[name] = proxy
+    package.loaded[decl.module] = proxy
+    setfield(decl.module, proxy)
+    return proxy
+end
+
+for name in pairs(modules) do
+    package.preload[name] = function ()
+        local decl = modules[name]
+        if not decl or overridden(name) then
+            state[name] = "loaded"
+            return find_loader(name)(name)
+        end
+        if decl == true then decl = require(name .. "_manifest") end
+        return register(name, decl)
+    end
+end
+
+-- vim: et:sw=4:ts=8:sts=4:tw=80
@@ -0,0 +1,18 @@
+------------------------------------------------------------
+-- Autoload manifest of bookmarks.lua                     --
+-- © 2011 Mason Larobina <mason.larobina@gmail.com>       --
+------------------------------------------------------------
+
+-- Read by autoload.lua to stub the module until it is first used, keep it
+-- in sync with the binds, commands, chrome pages, methods and signals the
+-- module adds.
+return {
+    module = "bookmarks",
+    binds = {
+        normal = { { "key", {}, "B" }, { "buf", "^gb$" }, { "buf", "^gB$" } },
+    },
+    cmds = { {"bookmark", "bm"}, "bookdel", "bookmarks" },
+    chrome = { "bookmarks/" },
+}
+
+-- vim: et:sw=4:ts=8:sts=4:tw=80
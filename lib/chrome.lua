@@ -23,14 +23,20 @@ module("chrome")
 -- Ordered list of chrome page generation rules
 local rules = {}
 
+-- Rule patterns are always anchored
+local function anchor(pat)
+    if string.match(pat, '^^') then pat = string.sub(pat, 2) end
+    return '^' .. pat
+end
+
 function add(pat, func)
     assert(type(pat) == "string", "invalid pattern")
     assert(type(func) == "function", "invalid function")
-    if string.match(pat, '^^') then pat = string.sub(pat, 2) end
-    table.insert(rules, { pat = '^' .. pat, func = func })
+    table.insert(rules, { pat = anchor(pat), func = func })
 end
 
 function del(pat)
+    pat = anchor(pat)
     for i, r in ipairs(rules) do
         if r.pat == pat then
             return table.remove(rules, i)
@@ -38,6 +44,14 @@ function del(pat)
     end
 end
 
+-- Returns the function of the first rule with the given pattern
+function get(pat)
+    pat = anchor(pat)
+    for _, r in ipairs(rules) do
+        if r.pat == pat then return r.func end
+    end
+end
+
 webview.init_funcs.chrome = function (view, w)
     view:add_signal("navigation-request", function (v, ustr)
         uri = lousy.uri.parse(ustr)
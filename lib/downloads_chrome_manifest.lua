@@ -0,0 +1,15 @@
+------------------------------------------------------------
+-- Autoload manifest of downloads_chrome.lua              --
+-- © 2011 Mason Larobina <mason.larobina@gmail.com>       --
+------------------------------------------------------------
+
+-- Read by autoload.lua to stub the module until it is first used, keep it
+-- in sync with the binds, commands, chrome pages, methods and signals the
+-- module adds.
+return {
+    module = "downloads.chrome",
+    binds = { normal = { { "buf", "^gd$" }, { "buf", "^gD$" } } },
+    chrome = { "downloads/" },
+}
+
+-- vim: et:sw=4:ts=8:sts=4:tw=80
@@ -8,12 +8,14 @@ local ipairs, pairs = ipairs, pairs
 local table, string = table, string
 local tonumber, tostring = tonumber, tostring
 local type, unpack = type, unpack
+local assert = assert
 
 local lousy = require "lousy"
 local webview = webview
 local downloads = require "downloads"
 local add_binds, new_mode = add_binds, new_mode
 local theme = theme
+local capi = { luakit = luakit }
 
 module("follow")
 
@@ -306,7 +308,7 @@ window.follow = (function () {
                 }
             });
             var len = visibleHints.length;
-            return "" + len + " " + reselect;
+            return [len, reselect];
         },
 
         // Evaluates the given element or the active element, if none is given.
@@ -638,11 +640,19 @@ add_binds("normal", {
     end),
 })
 
+-- Register the main following js once, it is injected into each frame by id
+-- when entering follow mode.
+do
+    local js, count = string.gsub(follow_js, "{(%w+)}", { clear = clear_js })
+    assert(count == 1, "invalid number of substitutions")
+    assert(capi.luakit.register_script{ id = "follow", source = js, filename = "(follow.lua)" })
+end
+
 -- Check if following is possible safely
 local function is_ready(w)
-    for _, f in ipairs(w:get_current().frames) do
-        local ret = w:eval_js("!!(document.activeElement && window.follow)", "(follow.lua)", f)
-        if ret ~= "true" then return false end
+    for f in w:get_current():each_frame() do
+        local ret = w:eval_js("!!(document.activeElement && window.follow)", "(follow.lua)", {frame = f, structured = true})
+        if ret ~= true then return false end
     end
     return true
 end
@@ -683,7 +693,7 @@ end
 local function focus(w, offset)
     if not is_ready(w) then return w:set_mode() end
     local function is_focused(f)
-        return (w:eval_js("follow.focused();", "(follow.lua)", f) == "true")
+        return (w:eval_js("follow.focused();", "(follow.lua)", {frame = f, structured = true}) == true)
     end
     -- sort frames with currently active one first
     local frames = w:get_current().frames
@@ -695,8 +705,8 @@ local function focus(w, offset)
     end
     -- ask all frames to jump to the next hint until one responds
     for _, f in ipairs(frames) do
-        local ret = w:eval_js(string.format("follow.focus(%i);", offset), "(follow.lua)", f)
-        if ret == "true" then return end
+        local ret = w:eval_js(string.format("follow.focus(%i);", offset), "(follow.lua)", {frame = f, structured = true})
+        if ret == true then return end
     end
     -- we get here, if only one frame has visible hints and it reached its limit
     -- in the preciding loop. Thus, we ask it to refocus again
@@ -753,11 +763,8 @@ new_mode("follow", {
         local webkit_frames = w:get_current().frames
         for _, f in ipairs(webkit_frames) do
             -- Load main following js
+            w:get_current():inject_script("follow", f)
             local js_blocks = {}
-            local subs = { clear = clear_js }
-            local js, count = string.gsub(follow_js, "{(%w+)}", subs)
-            if count ~= 1 then return error("invalid number of substitutions") end
-            table.insert(js_blocks, js);
 
             -- Make theme js
             for k, v in pairs(get_theme()) do
@@ -778,7 +785,7 @@ new_mode("follow", {
             local js = table.concat(js_blocks, "\n")
             w:eval_js(js, "(follow.lua)", f)
 
-            local num = tonumber(w:eval_js(string.format("follow.match(%q, %s);", selector, tostring(#webkit_frames == 1)), "(follow.lua)", f))
+            local num = w:eval_js(string.format("follow.match(%q, %s);", selector, tostring(#webkit_frames == 1)), "(follow.lua)", {frame = f, structured = true}) or 0
             table.insert(frames, {num = num, frame = f})
             sum = sum + num
         end
@@ -815,9 +822,7 @@ new_mode("follow", {
     -- Leave follow mode hook
     leave = function (w)
         if w.eval_js then
-            for _,f in ipairs(w:get_current().frames) do
-                w:eval_js(clear_js, "(follow.lua)", f)
-            end
+            w:get_current():eval_js_all_frames(clear_js, {filename = "(follow.lua)"})
         end
     end,
 
@@ -828,13 +833,14 @@ new_mode("follow", {
         local filter, id = parse_input(text)
         local active_hints = 0
         local eval_frame
-        for _, f in ipairs(w:get_current().frames) do
-            local ret = w:eval_js(string.format("follow.filter(%q, %q);", filter, id), "(follow.lua)", f)
-            ret = lousy.util.string.split(ret)
-            local num = tonumber(ret[1])
-            local reselect = (ret[2] == "true")
+        local js = string.format("follow.filter(%q, %q);", filter, id)
+        local results = w:get_current():eval_js_all_frames(js, {filename = "(follow.lua)", structured = true})
+        for _, r in ipairs(results) do
+            local ret = r.result or {}
+            local num = ret[1] or 0
+            local reselect = ret[2]
             if reselect then focus(w, 1) end
-            if num == 1 then eval_frame = f end
+            if num == 1 then eval_frame = r.frame end
             active_hints = active_hints + num
         end
         if state.reselect then focus(w, 1) end
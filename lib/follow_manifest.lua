@@ -0,0 +1,24 @@
+------------------------------------------------------------
+-- Autoload manifest of follow.lua                        --
+-- © 2011 Mason Larobina <mason.larobina@gmail.com>       --
+------------------------------------------------------------
+
+-- Read by autoload.lua to stub the module until it is first used, keep it
+-- in sync with the binds, commands, chrome pages, methods and signals the
+-- module adds.
+return {
+    module = "follow",
+    binds = {
+        normal = {
+            { "buf", "^f$" },  { "buf", "^;;$" }, { "buf", "^F$" },
+            { "buf", "^;y$" }, { "buf", "^;Y$" }, { "buf", "^;F$" },
+            { "buf", "^;s$" }, { "buf", "^;i$" }, { "buf", "^;I$" },
+            { "buf", "^;o$" }, { "buf", "^;t$" }, { "buf", "^;b$" },
+            { "buf", "^;w$" }, { "buf", "^;O$" }, { "buf", "^;T$" },
+            { "buf", "^;W$" },
+        },
+    },
+    methods = { webview = { "start_follow" } },
+}
+
+-- vim: et:sw=4:ts=8:sts=4:tw=80
@@ -0,0 +1,20 @@
+------------------------------------------------------------
+-- Autoload manifest of formfiller.lua                    --
+-- © 2011 Mason Larobina <mason.larobina@gmail.com>       --
+------------------------------------------------------------
+
+-- Read by autoload.lua to stub the module until it is first used, keep it
+-- in sync with the binds, commands, chrome pages, methods and signals the
+-- module adds.
+return {
+    binds = {
+        normal = {
+            { "buf", "^za$" }, { "buf", "^zn$" },
+            { "buf", "^ze$" }, { "buf", "^zl$" },
+        },
+    },
+    methods = { webview = { "formfiller" } },
+    signals = { soup = { "authenticate", "store-password" } },
+}
+
+-- vim: et:sw=4:ts=8:sts=4:tw=80
@@ -0,0 +1,16 @@
+------------------------------------------------------------
+-- Autoload manifest of quickmarks.lua                    --
+-- © 2011 Mason Larobina <mason.larobina@gmail.com>       --
+------------------------------------------------------------
+
+-- Read by autoload.lua to stub the module until it is first used, keep it
+-- in sync with the binds, commands, chrome pages, methods and signals the
+-- module adds.
+return {
+    module = "quickmarks",
+    binds = { normal = { { "buf", "^g[onw]%w$" }, { "buf", "^M%w$" } } },
+    cmds = { "qma[rk]", {"qmarkedit", "qme"}, "delqm[arks]", "qmarks",
+        {"delqmarks!", "delqm!"} },
+}
+
+-- vim: et:sw=4:ts=8:sts=4:tw=80
@@ -7,10 +7,25 @@ local function rm(file)
     luakit.spawn(string.format("rm %q", file))
 end
 
+-- Check if the view is still a tab of any window
+local function is_open(view)
+    for _, w in pairs(window.bywidget) do
+        if w.tabs:indexof(view) then return true end
+    end
+end
+
 -- Session functions
 session = {
     file = luakit.cache_dir .. "/session",
 
+    -- Only load the current tab of each restored window, the other tabs
+    -- load once they are switched to (or preloaded in the background).
+    lazy = true,
+
+    -- Number of lazy tabs to load in the background after a restore (one
+    -- tab at a time, in session order).
+    preload = 5,
+
     -- Save all given windows uris to file.
     save = function (wins)
         local lines = {}
@@ -18,8 +33,10 @@ session = {
         for wi, w in pairs(wins) do
             local current = w.tabs:current()
             for ti = 1, w.tabs:count() do
-                local uri = w.tabs:atindex(ti).uri or "about:blank"
-                table.insert(lines, string.format("%d\t%d\t%s\t%s", wi, ti, tostring(current == ti), uri))
+                local view = w.tabs:atindex(ti)
+                local uri = view.uri or "about:blank"
+                local title = string.gsub(view:get_property("title") or "", "%s", " ")
+                table.insert(lines, string.format("%d\t%d\t%s\t%s\t%s", wi, ti, tostring(current == ti), uri, title))
             end
         end
 
@@ -49,11 +66,13 @@ session = {
         -- Parse session file
         local split = lousy.util.string.split
         for _, line in ipairs(lines) do
-            local wi, ti, current, uri = unpack(split(line, "\t"))
+            local wi, ti, current, uri, title = unpack(split(line, "\t"))
             wi = tonumber(wi)
             current = (current == "true")
             if not ret[wi] then ret[wi] = {} end
-            table.insert(ret[wi], {uri = uri, current = current})
+            -- Untitled tabs fall back to showing their uri
+            if title == "" then title = nil end
+            table.insert(ret[wi], {uri = uri, title = title, current = current})
         end
 
         return (#ret > 0 and ret) or nil
@@ -66,19 +85,68 @@ session = {
 
         -- Spawn windows
         local w
+        local queue = {}
         for _, win in ipairs(wins) do
             w = nil
-            for _, item in ipairs(win) do
-                if not w then
-                    w = window.new({item.uri})
+            local blank, pos = nil, #queue + 1
+            for i, item in ipairs(win) do
+                local lazy = session.lazy and not item.current
+                if i == 1 then
+                    -- The first tab can only be made a placeholder once
+                    -- another tab is shown, start with a blank one
+                    w = window.new({lazy and "about:blank" or item.uri})
+                    if lazy then blank = w.tabs:atindex(1) end
+                elseif lazy then
+                    -- Placeholder tab which only holds the uri & title
+                    local view = w:new_tab(nil, false)
+                    view:discard{ uri = item.uri, title = item.title }
+                    table.insert(queue, view)
                 else
                     w:new_tab(item.uri, item.current)
                 end
             end
+
+            if blank then
+                local item = win[1]
+                if blank:discard{ uri = item.uri, title = item.title } then
+                    table.insert(queue, pos, blank)
+                else
+                    -- Still shown (no other tab was current)
+                    blank.uri = item.uri
+                end
+            end
+
+            -- Show the titles of the placeholder tabs
+            w:update_tablist()
         end
 
+        session.preload_tabs(queue, session.preload)
         return w
     end,
+
+    -- Load up to `limit` of the given discarded views in the background, one
+    -- after another
+    preload_tabs = function (views, limit)
+        local current
+        local t = timer{interval = 1000}
+        t:add_signal("timeout", function ()
+            -- Wait for the previous tab to finish loading
+            if current and is_open(current) and current:loading() then return end
+            current = nil
+            while limit > 0 and #views > 0 do
+                local view = table.remove(views, 1)
+                -- Skip closed or already loaded tabs
+                if is_open(view) and view.discarded then
+                    limit = limit - 1
+                    view:restore()
+                    current = view
+                    return
+                end
+            end
+            t:stop()
+        end)
+        t:start()
+    end,
 }
 
 -- Save current window session helper
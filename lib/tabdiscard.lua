@@ -0,0 +1,65 @@
+------------------------------------------------------------
+-- Discard the pages of long inactive tabs to save memory --
+-- © 2011 Mason Larobina <mason.larobina@gmail.com>       --
+------------------------------------------------------------
+
+local pairs = pairs
+local ipairs = ipairs
+local setmetatable = setmetatable
+local os = os
+local window = window
+local webview = webview
+local capi = { timer = timer }
+
+module("tabdiscard")
+
+--- Minutes a tab has to be inactive before its page is discarded, tabs are
+-- never discarded unless this is set. A discarded tab keeps its history,
+-- scroll position, zoom, settings and title (but loses any other page state)
+-- and is reloaded once it is shown again.
+timeout = nil
+
+--- Views which should never be discarded (i.e. `tabdiscard.keep[view] = true`)
+keep = setmetatable({}, { __mode = "k" })
+
+-- Last time each view was the current tab of its window
+local last_active = setmetatable({}, { __mode = "k" })
+
+-- Returns true if the view should be discarded
+function should_discard(view, now)
+    if not timeout or keep[view] or view.discarded or view:loading() then
+        return false
+    end
+    return now - (last_active[view] or now) >= timeout * 60
+end
+
+local function check()
+    if not timeout then return end
+    local now = os.time()
+    for _, w in pairs(window.bywidget) do
+        local current = w:get_current()
+        for _, view in ipairs(w.tabs:get_children()) do
+            if view == current then
+                last_active[view] = now
+            elseif should_discard(view, now) then
+                view:discard()
+            end
+        end
+    end
+end
+
+webview.init_funcs.tabdiscard_init = function (view, w)
+    last_active[view] = os.time()
+end
+
+window.init_funcs.tabdiscard_update = function (w)
+    w.tabs:add_signal("switch-page", function (nbook, view, idx)
+        last_active[view] = os.time()
+    end)
+end
+
+local check_timer = capi.timer{ interval = 60e3 }
+check_timer:add_signal("timeout", check)
+check_timer:start()
+
+-- vim: et:sw=4:ts=8:sts=4:tw=80
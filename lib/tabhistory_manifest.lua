@@ -0,0 +1,14 @@
+------------------------------------------------------------
+-- Autoload manifest of tabhistory.lua                    --
+-- © 2011 Mason Larobina <mason.larobina@gmail.com>       --
+------------------------------------------------------------
+
+-- Read by autoload.lua to stub the module until it is first used, keep it
+-- in sync with the binds, commands, chrome pages, methods and signals the
+-- module adds.
+return {
+    cmds = { "tabhistory" },
+    methods = { window = { "tab_history" } },
+}
+
+-- vim: et:sw=4:ts=8:sts=4:tw=80
@@ -141,10 +141,10 @@ local prototype = {
     run = function (s, view)
         -- Load common greasemonkey methods
         if not lstate[view].gmloaded then
-            view:eval_js(gm_functions, "(userscript:gm_functions)")
+            view:inject_script("userscripts:gm_functions")
             lstate[view].gmloaded = true
         end
-        view:eval_js(s.js, string.format("(userscript:%s)", s.file))
+        view:inject_script(s.id)
         lstate[view].loaded[s.file] = s
     end,
     -- Check if the given uri matches the userscripts include/exclude patterns
@@ -173,7 +173,7 @@ local function parse_pattern(pat)
 end
 
 local function parse_header(header, file)
-    local ret = { file = file, include = {}, exclude = {} }
+    local ret = { file = file, include = {}, exclude = {}, globs = { include = {}, exclude = {} } }
     for i, line in ipairs(util.string.split(header, "\n")) do
         -- Parse `// @key value` line in header.
         local key, val = string.match(line, "^// @([%w%-]+)%s+(.+)$")
@@ -185,6 +185,7 @@ local function parse_header(header, file)
                 if not ret[key] then ret[key] = val end
             elseif key == "include" or key == "exclude" then
                 table.insert(ret[key], parse_pattern(val))
+                table.insert(ret.globs[key], val)
             elseif key == "run-at" and val == "document-start" then
                 ret.on_start = true
             end
@@ -207,6 +208,21 @@ local function load_js(file)
     if header then
         local script = parse_header(header, file)
         script.js = js
+        script.id = "userscript:" .. file
+        -- Scripts which run at document start are injected by luakit itself
+        -- (with the greasemonkey methods prepended)
+        local ok, err = capi.luakit.register_script{
+            id = script.id,
+            source = script.on_start and (gm_functions .. "\n" .. js) or js,
+            filename = string.format("(userscript:%s)", file),
+            inject = script.on_start and "document-start" or nil,
+            include = script.globs.include,
+            exclude = script.globs.exclude,
+        }
+        if not ok then
+            warn("(userscripts.lua): Unable to load userscript %s: %s", file, err)
+            return
+        end
         scripts[file] = setmetatable(script, { __index = prototype })
     else
         warn("(userscripts.lua): Invalid userscript header in file: %s", file)
@@ -214,21 +230,33 @@ local function load_js(file)
 end
 
 --- Loads all userscripts from the <code>userscripts.dir</code>.
+-- Scripts which are gone (or fail to load) are unregistered.
 local function load_all()
-    if not os.exists(dir) then return end
-    for file in lfs.dir(dir) do
-        if string.match(file, "%.user%.js$") then
-            load_js(dir .. "/" .. file)
+    local old = scripts
+    scripts = {}
+    if os.exists(dir) then
+        for file in lfs.dir(dir) do
+            if string.match(file, "%.user%.js$") then
+                load_js(dir .. "/" .. file)
+            end
+        end
+    end
+    for file, script in pairs(old) do
+        if not scripts[file] then
+            capi.luakit.unregister_script(script.id)
         end
     end
 end
 
 -- Invoke all userscripts for a given webviews current uri
-local function invoke(view, on_start)
+local function invoke(view)
     local uri = view.uri or "about:blank"
     for _, script in pairs(scripts) do
-        if on_start == script.on_start then
-            if script:match(uri) then
+        if script:match(uri) then
+            if script.on_start then
+                -- Already injected by luakit at document start
+                lstate[view].loaded[script.file] = script
+            else
                 script:run(view)
             end
         end
@@ -241,8 +269,6 @@ webview.init_funcs.userscripts = function (view, w)
         if status == "provisional" then
             -- Clear last userscript-loaded state
             lstate[v] = { loaded = {}, gmloaded = false }
-        elseif status == "first-visual" then
-            invoke(v, true)
         elseif status == "finished" then
             invoke(v)
         end
@@ -250,6 +276,8 @@ webview.init_funcs.userscripts = function (view, w)
 end
 
 -- Initialize the userscripts
+capi.luakit.register_script{ id = "userscripts:gm_functions",
+    source = gm_functions, filename = "(userscript:gm_functions)" }
 load_all()
 
 -- vim: et:sw=4:ts=8:sts=4:tw=80
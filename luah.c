@@ -20,13 +20,18 @@
  */
 
 #include "luah.h"
+#include "common/loader.h"
+#include "common/trace.h"
 
 /* include clib headers */
+#include "clib/async.h"
 #include "clib/download.h"
+#include "clib/frame.h"
 #include "clib/soup/soup.h"
 #include "clib/sqlite3.h"
 #include "clib/timer.h"
 #include "clib/widget.h"
+#include "clib/worker.h"
 #include "clib/luakit.h"
 
 #include <glib.h>
@@ -360,25 +365,55 @@ luaH_init(void)
 
     luaH_fixups(L);
 
+    /* load modules through the bytecode cache */
+    loader_setup(L);
+
     luaH_object_setup(L);
 
     /* Export luakit lib */
+    trace_begin("setup", "luakit lib");
     luakit_lib_setup(L);
+    trace_end("setup", "luakit lib");
 
     /* Export soup lib */
+    trace_begin("setup", "soup lib");
     soup_lib_setup(L);
+    trace_end("setup", "soup lib");
+
+    /* Export async lib */
+    trace_begin("setup", "async lib");
+    async_lib_setup(L);
+    trace_end("setup", "async lib");
+
+    /* Export worker lib */
+    trace_begin("setup", "worker lib");
+    worker_lib_setup(L);
+    trace_end("setup", "worker lib");
 
     /* Export widget */
+    trace_begin("setup", "widget class");
     widget_class_setup(L);
+    trace_end("setup", "widget class");
 
     /* Export download */
+    trace_begin("setup", "download class");
     download_class_setup(L);
+    trace_end("setup", "download class");
+
+    /* Export frame */
+    trace_begin("setup", "frame class");
+    frame_class_setup(L);
+    trace_end("setup", "frame class");
 
     /* Export sqlite3 */
+    trace_begin("setup", "sqlite3 class");
     sqlite3_class_setup(L);
+    trace_end("setup", "sqlite3 class");
 
     /* Export timer */
+    trace_begin("setup", "timer class");
     timer_class_setup(L);
+    trace_end("setup", "timer class");
 
     /* add Lua search paths */
     lua_getglobal(L, "package");
@@ -437,6 +472,14 @@ luaH_init(void)
 
     /* remove package module from stack */
     lua_pop(L, 1);
+
+    /* hook lazily loaded modules into package.preload (see lib/autoload.lua) */
+    lua_getglobal(L, "require");
+    lua_pushliteral(L, "autoload");
+    if (lua_pcall(L, 1, 0, 0)) {
+        warn("unable to setup module autoloading: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
 }
 
 gboolean
@@ -444,9 +487,12 @@ luaH_loadrc(const gchar *confpath, gboolean run)
 {
     debug("Loading rc: %s", confpath);
     lua_State *L = globalconf.L;
-    if(!luaL_loadfile(L, confpath)) {
+    if(!luaH_loadfile_cached(L, confpath)) {
         if(run) {
-            if(lua_pcall(L, 0, LUA_MULTRET, 0)) {
+            trace_begin("lua", confpath);
+            gint status = lua_pcall(L, 0, LUA_MULTRET, 0);
+            trace_end("lua", confpath);
+            if(status) {
                 g_fprintf(stderr, "%s\n", lua_tostring(L, -1));
             } else
                 return TRUE;
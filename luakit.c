@@ -19,7 +19,10 @@
  */
 
 #include "globalconf.h"
+#include "common/loader.h"
+#include "common/trace.h"
 #include "common/util.h"
+#include "common/watchdog.h"
 #include "luah.h"
 
 #include <gtk/gtk.h>
@@ -48,7 +51,9 @@ init_lua(gchar **uris)
     globalconf.windows = g_ptr_array_new();
 
     /* init lua */
+    trace_begin("startup", "luaH_init");
     luaH_init();
+    trace_end("startup", "luaH_init");
     L = globalconf.L;
 
     /* push a table of the statup uris */
@@ -82,16 +87,21 @@ parseopts(int argc, gchar *argv[], gboolean **nonblock) {
 
     /* save luakit exec path */
     globalconf.execpath = g_strdup(argv[0]);
+    /* the stall watchdog is off unless a threshold is given, its lua hook
+     * stops LuaJIT from compiling traces */
+    globalconf.stall_threshold = 0;
 
     /* define command line options */
     const GOptionEntry entries[] = {
-      { "uri",     'u', 0, G_OPTION_ARG_STRING_ARRAY, &uris,                 "uri(s) to load at startup", "URI"  },
-      { "config",  'c', 0, G_OPTION_ARG_STRING,       &globalconf.confpath,  "configuration file to use", "FILE" },
-      { "verbose", 'v', 0, G_OPTION_ARG_NONE,         &globalconf.verbose,   "print debugging output",    NULL   },
-      { "version", 'V', 0, G_OPTION_ARG_NONE,         &version_only,         "print version and exit",    NULL   },
-      { "check",   'k', 0, G_OPTION_ARG_NONE,         &check_only,           "check config and exit",     NULL   },
-      { "nonblock",'n', 0, G_OPTION_ARG_NONE,         nonblock,              "run in background",         NULL   },
-      { NULL,      0,   0, 0,                         NULL,                  NULL,                        NULL   },
+      { "uri",             'u', 0, G_OPTION_ARG_STRING_ARRAY, &uris,                       "uri(s) to load at startup", "URI"  },
+      { "config",          'c', 0, G_OPTION_ARG_STRING,       &globalconf.confpath,        "configuration file to use", "FILE" },
+      { "verbose",         'v', 0, G_OPTION_ARG_NONE,         &globalconf.verbose,         "print debugging output",    NULL   },
+      { "version",         'V', 0, G_OPTION_ARG_NONE,         &version_only,               "print version and exit",    NULL   },
+      { "check",           'k', 0, G_OPTION_ARG_NONE,         &check_only,                 "check config and exit",     NULL   },
+      { "nonblock",        'n', 0, G_OPTION_ARG_NONE,         nonblock,                    "run in background",         NULL   },
+      { "stall-threshold", 0,   0, G_OPTION_ARG_INT,          &globalconf.stall_threshold, "report main loop stalls longer than MS (slows down lua, disables the LuaJIT compiler)", "MS" },
+      { "trace-startup",   0,   0, G_OPTION_ARG_FILENAME,     &globalconf.trace_file,      "write a startup trace (chrome trace-event JSON) to FILE", "FILE" },
+      { NULL,              0,   0, 0,                         NULL,                        NULL,                        NULL   },
     };
 
     /* parse command line options */
@@ -136,6 +146,7 @@ main(gint argc, gchar *argv[]) {
     gboolean *nonblock = NULL;
     gchar **uris = NULL;
     pid_t pid, sid;
+    gint64 start = g_get_monotonic_time();
 
     /* clean up any zombies */
     struct sigaction sigact;
@@ -145,6 +156,10 @@ main(gint argc, gchar *argv[]) {
     if (sigaction(SIGCHLD, &sigact, NULL))
         fatal("Can't install SIGCHLD handler");
 
+    /* writing to the stdin pipe of a spawned process which already exited
+     * must not kill luakit */
+    signal(SIGPIPE, SIG_IGN);
+
     /* set numeric locale to C (required for compatibility with
        LuaJIT and luakit scripts) */
     gtk_set_locale();
@@ -168,7 +183,12 @@ main(gint argc, gchar *argv[]) {
         }
     }
 
+    /* record startup spans (see --trace-startup) */
+    trace_init(globalconf.trace_file, start);
+
+    trace_begin("startup", "gtk_init");
     gtk_init(&argc, &argv);
+    trace_end("startup", "gtk_init");
     if (!g_thread_supported())
         g_thread_init(NULL);
 
@@ -179,9 +199,15 @@ main(gint argc, gchar *argv[]) {
     if(!luaH_parserc(globalconf.confpath, TRUE))
         fatal("couldn't find rc file");
 
+    /* print module search statistics (in verbose mode) */
+    loader_report();
+
     if (!globalconf.windows->len)
         fatal("no windows spawned by rc file, exiting");
 
+    /* report lua handlers which block the main loop */
+    watchdog_init(MAX(globalconf.stall_threshold, 0));
+
     gtk_main();
     return EXIT_SUCCESS;
 }
@@ -18,6 +18,7 @@
  *
  */
 
+#include "clib/soup/soup.h"
 #include "luah.h"
 #include "widgets/common.h"
 
@@ -261,6 +262,9 @@ switch_cb(GtkNotebook *n, GtkNotebookPage *p, guint i, widget_t *w)
     GtkWidget *widget = gtk_notebook_get_nth_page(GTK_NOTEBOOK(n), i);
     widget_t *child = g_object_get_data(G_OBJECT(widget), "lua_widget");
 
+    /* let the requests the page deferred while in the background go */
+    soup_scheduler_promote(child);
+
     lua_State *L = globalconf.L;
     luaH_object_push(L, w->ref);
     luaH_object_push(L, child->ref);
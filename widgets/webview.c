@@ -22,13 +22,20 @@
 #include <webkit/webkit.h>
 #include <libsoup/soup-message.h>
 #include <math.h>
+#include <string.h>
 
 #include "globalconf.h"
 #include "luah.h"
 #include "widgets/common.h"
+#include "widgets/webview.h"
 #include "clib/download.h"
+#include "clib/frame.h"
 #include "clib/soup/soup.h"
+#include "common/histogram.h"
+#include "common/luajs.h"
+#include "common/luastats.h"
 #include "common/property.h"
+#include "common/trace.h"
 
 GHashTable *frames_by_view = NULL;
 
@@ -42,6 +49,55 @@ typedef struct {
     WebKitWebFrame *f;
 } frame_destroy_callback_t;
 
+/* resource usage counters of a view */
+typedef struct {
+    guint requests;
+    guint blocked;
+    guint js_evals;
+    /* time spent evaluating scripts (in ms) */
+    gdouble js_time;
+} webview_stats_t;
+
+/* monotonic timestamps (in µs) of the load phases of a navigation */
+typedef struct {
+    gchar *uri;
+    gint64 provisional;
+    gint64 committed;
+    gint64 first_visual;
+    gint64 finished;
+    guint resources;
+    gboolean failed;
+} load_timing_t;
+
+typedef struct {
+    /* the navigation in progress */
+    load_timing_t current;
+    /* the last completed navigation */
+    load_timing_t last;
+} webview_load_timing_t;
+
+/* load phase timings (in ms) of all navigations by host */
+typedef struct {
+    guint loads;
+    guint failed;
+    histogram_t committed;
+    histogram_t first_visual;
+    histogram_t finished;
+} host_load_timing_t;
+
+static GHashTable *load_timing_by_host = NULL;
+
+/* state of a discarded view, kept until the view has been restored */
+typedef struct {
+    gchar *title;
+    /* ref of the history table of the view */
+    gpointer history;
+    gdouble scroll_horiz;
+    gdouble scroll_vert;
+    gboolean restoring;
+    gboolean loading;
+} webview_discarded_t;
+
 GHashTable *webview_properties = NULL;
 property_t webview_properties_table[] = {
   { "auto-load-images",                             BOOL,   SETTINGS,    TRUE,  NULL },
@@ -98,31 +154,67 @@ property_t webview_properties_table[] = {
   { NULL,                                           0,      0,           0,     NULL },
 };
 
+typedef struct {
+    JSContextRef context;
+    gpointer ref;
+    size_t argc;
+    const JSValueRef *argv;
+    JSValueRef ret;
+} webview_call_t;
+
+/* Converts the arguments, calls the registered function and converts its
+ * result, run protected as the conversions may raise errors. */
+static gint
+webview_registered_function_call(lua_State *L)
+{
+    webview_call_t *call = lua_touserdata(L, 1);
+    lua_pop(L, 1);
+
+    // the page controls the number (and nesting) of the arguments, the
+    // conversion is bounded by the limits of luaJS_pushvalue
+    luaL_checkstack(L, call->argc + 1, "too many arguments");
+    // get function
+    luaH_object_push(L, call->ref);
+    // push arguments
+    for (size_t i = 0; i < call->argc; i++)
+        luaJS_pushvalue(L, call->context, call->argv[i], LUAJS_MAX_DEPTH);
+    // call function
+    lua_call(L, call->argc, 1);
+    if (!lua_isnil(L, -1))
+        call->ret = luaJS_tovalue(L, call->context, -1, LUAJS_MAX_DEPTH);
+    return 0;
+}
+
+/* Calls the lua function registered with view:register_function with the
+ * javascript arguments converted to lua values and returns the result of
+ * the function converted back to a javascript value. */
 static JSValueRef
 webview_registered_function_callback(JSContextRef context, JSObjectRef fun,
         JSObjectRef thisObject, size_t argumentCount,
         const JSValueRef *arguments, JSValueRef *exception)
 {
     (void) thisObject;
-    (void) argumentCount;
-    (void) arguments;
 
     lua_State *L = globalconf.L;
-    gpointer ref = JSObjectGetPrivate(fun);
-    // get function
-    luaH_object_push(L, ref);
-    // call function
-    gint ret = lua_pcall(L, 0, 0, 0);
-    // handle errors
-    if (ret != 0) {
-        const gchar *exn_cstring = luaL_checkstring(L, -1);
-        lua_pop(L, 1);
-        JSStringRef exn_js_string = JSStringCreateWithUTF8CString(exn_cstring);
+    gint top = lua_gettop(L);
+    webview_call_t call = {
+        .context = context,
+        .ref = JSObjectGetPrivate(fun),
+        .argc = argumentCount,
+        .argv = arguments,
+    };
+
+    if (lua_cpcall(L, webview_registered_function_call, &call)) {
+        // handle errors
+        const gchar *exn_cstring = lua_tostring(L, -1);
+        JSStringRef exn_js_string = JSStringCreateWithUTF8CString(NONULL(exn_cstring));
         JSValueRef exn_js_value = JSValueMakeString(context, exn_js_string);
         *exception = JSValueToObject(context, exn_js_value, NULL);
         JSStringRelease(exn_js_string);
+        call.ret = NULL;
     }
-    return JSValueMakeUndefined(context);
+    lua_settop(L, top);
+    return call.ret ? call.ret : JSValueMakeUndefined(context);
 }
 
 static void
@@ -153,85 +245,101 @@ webview_register_function(WebKitWebFrame *frame, const gchar *name, gpointer ref
     JSClassRelease(class);
 }
 
-static const gchar*
-webview_eval_js(WebKitWebFrame *frame, const gchar *script, const gchar *file)
+static webview_stats_t*
+webview_stats_get(widget_t *w)
 {
-    JSGlobalContextRef context;
-    JSObjectRef globalobject;
-    JSStringRef js_file;
-    JSStringRef js_script;
-    JSValueRef js_result;
-    JSValueRef js_exc = NULL;
-    JSStringRef js_result_string;
-    GString *result = g_string_new(NULL);
-    size_t js_result_size;
+    webview_stats_t *stats = g_object_get_data(G_OBJECT(w->widget), "stats");
+    if (!stats) {
+        stats = g_new0(webview_stats_t, 1);
+        g_object_set_data_full(G_OBJECT(w->widget), "stats", stats, g_free);
+    }
+    return stats;
+}
+
+/* Returns the webview widget holding the given WebKitWebView */
+static widget_t*
+webview_get_widget(WebKitWebView *v)
+{
+    GtkWidget *parent = v ? gtk_widget_get_parent(GTK_WIDGET(v)) : NULL;
+    return parent ? g_object_get_data(G_OBJECT(parent), "lua_widget") : NULL;
+}
 
-    context = webkit_web_frame_get_global_context(frame);
-    globalobject = JSContextGetGlobalObject(context);
+/* Evaluates the script in the given frame and returns the result. On
+ * exception the exception is printed, NULL returned and the exception
+ * message stored in `error` (if given). */
+static JSValueRef
+webview_eval_jsstring(WebKitWebFrame *frame, JSStringRef js_script,
+        JSStringRef js_file, gchar **error)
+{
+    JSGlobalContextRef context = webkit_web_frame_get_global_context(frame);
+    JSObjectRef globalobject = JSContextGetGlobalObject(context);
+    JSValueRef js_exc = NULL;
+    gint64 start = g_get_monotonic_time();
 
     /* evaluate the script and get return value*/
-    js_script = JSStringCreateWithUTF8CString(script);
-    js_file = JSStringCreateWithUTF8CString(file);
-    js_result = JSEvaluateScript(context, js_script, globalobject, js_file, 0, &js_exc);
-    if (js_result && !JSValueIsUndefined(context, js_result)) {
-        js_result_string = JSValueToStringCopy(context, js_result, NULL);
-        js_result_size = JSStringGetMaximumUTF8CStringSize(js_result_string);
-
-        if (js_result_size) {
-            gchar js_result_utf8[js_result_size];
-            JSStringGetUTF8CString(js_result_string, js_result_utf8, js_result_size);
-            g_string_assign(result, js_result_utf8);
-        }
-
-        JSStringRelease(js_result_string);
+    JSValueRef js_result = JSEvaluateScript(context, js_script, globalobject,
+            js_file, 0, &js_exc);
+
+    /* account the time to the view the script ran in */
+    widget_t *w = webview_get_widget(webkit_web_frame_get_web_view(frame));
+    if (w) {
+        webview_stats_t *stats = webview_stats_get(w);
+        stats->js_evals++;
+        stats->js_time += ELAPSED_MS(start, g_get_monotonic_time());
     }
-    else if (js_exc) {
-        size_t size;
-        JSStringRef prop, val;
-        JSObjectRef exc = JSValueToObject(context, js_exc, NULL);
-
-        g_printf("Exception occured while executing script:\n");
-
-        /* Print file */
-        prop = JSStringCreateWithUTF8CString("sourceURL");
-        val = JSValueToStringCopy(context, JSObjectGetProperty(context, exc, prop, NULL), NULL);
-        size = JSStringGetMaximumUTF8CStringSize(val);
-        if(size) {
-            gchar cstr[size];
-            JSStringGetUTF8CString(val, cstr, size);
-            g_printf("At %s", cstr);
-        }
-        JSStringRelease(prop);
-        JSStringRelease(val);
-
-        /* Print line */
-        prop = JSStringCreateWithUTF8CString("line");
-        val = JSValueToStringCopy(context, JSObjectGetProperty(context, exc, prop, NULL), NULL);
-        size = JSStringGetMaximumUTF8CStringSize(val);
-        if(size) {
-            gchar cstr[size];
-            JSStringGetUTF8CString(val, cstr, size);
-            g_printf(":%s: ", cstr);
-        }
-        JSStringRelease(prop);
-        JSStringRelease(val);
-
-        /* Print message */
-        val = JSValueToStringCopy(context, exc, NULL);
-        size = JSStringGetMaximumUTF8CStringSize(val);
-        if(size) {
-            gchar cstr[size];
-            JSStringGetUTF8CString(val, cstr, size);
-            g_printf("%s\n", cstr);
-        }
-        JSStringRelease(val);
+
+    if (!js_result && js_exc) {
+        gchar *msg = luaJS_exception_message(context, js_exc);
+        g_printf("Exception occured while executing script:\nAt %s\n", msg);
+        if (error)
+            *error = msg;
+        else
+            g_free(msg);
     }
 
+    return js_result;
+}
+
+static JSValueRef
+webview_eval_js(WebKitWebFrame *frame, const gchar *script, const gchar *file,
+        gchar **error)
+{
+    JSStringRef js_script = JSStringCreateWithUTF8CString(script);
+    JSStringRef js_file = JSStringCreateWithUTF8CString(file);
+    JSValueRef js_result = webview_eval_jsstring(frame, js_script, js_file,
+            error);
+
     /* cleanup */
     JSStringRelease(js_script);
     JSStringRelease(js_file);
+    return js_result;
+}
+
+/* Pushes the result of a script evaluation. Unless structured results are
+ * requested the result is converted to a string (undefined and exceptions
+ * give an empty string), otherwise the converted value is pushed or nil and
+ * the exception message. */
+static gint
+luaH_webview_push_js_result(lua_State *L, WebKitWebFrame *frame,
+        JSValueRef result, const gchar *error, gboolean structured, gint depth)
+{
+    JSGlobalContextRef context = webkit_web_frame_get_global_context(frame);
+
+    if (structured) {
+        if (result)
+            return luaJS_pushvalue(L, context, result, depth);
+        lua_pushnil(L);
+        lua_pushstring(L, error);
+        return 2;
+    }
 
-    return g_string_free(result, FALSE);
+    size_t len = 0;
+    gchar *str = NULL;
+    if (result && !JSValueIsUndefined(context, result))
+        str = luaJS_tostring(context, result, &len);
+    lua_pushlstring(L, NONULL(str), len);
+    g_free(str);
+    return 1;
 }
 
 inline static gint
@@ -239,6 +347,15 @@ luaH_webview_get_property(lua_State *L)
 {
     widget_t *w = luaH_checkwidget(L, 1);
     WebKitWebView *view = WEBKIT_WEB_VIEW(g_object_get_data(G_OBJECT(w->widget), "webview"));
+
+    /* discarded views keep their title until the page is back */
+    webview_discarded_t *d = g_object_get_data(G_OBJECT(w->widget), "discarded");
+    if (d && !webkit_web_view_get_title(view)
+            && !g_strcmp0(luaL_checkstring(L, 2), "title")) {
+        lua_pushstring(L, d->title);
+        return 1;
+    }
+
     return luaH_get_property(L, webview_properties, view, 2);
 }
 
@@ -284,33 +401,607 @@ luaH_webview_register_function(lua_State *L)
     return 0;
 }
 
+/* Returns the frame of a frame object or (for compatibility) a raw frame
+ * pointer at the given index or NULL if there is none */
+static WebKitWebFrame*
+luaH_webview_toframe(lua_State *L, gint idx)
+{
+    if (lua_islightuserdata(L, idx))
+        return lua_touserdata(L, idx);
+    else if (lua_type(L, idx) == LUA_TUSERDATA)
+        return luaH_checkframe(L, idx);
+    return NULL;
+}
+
+/* Returns the frame selected by an eval_js style argument, which is either
+ * a frame, a boolean (true for the focused frame) or an options table with
+ * "frame" and "focused" fields. Defaults to the main frame. */
+static WebKitWebFrame*
+luaH_webview_optframe(lua_State *L, WebKitWebView *view, gint idx)
+{
+    WebKitWebFrame *frame = NULL;
+
+    if (lua_istable(L, idx)) {
+        lua_getfield(L, idx, "frame");
+        frame = luaH_webview_toframe(L, -1);
+        lua_pop(L, 1);
+        if (!frame && luaH_getopt_boolean(L, idx, "focused", FALSE))
+            frame = webkit_web_view_get_focused_frame(view);
+    } else if (lua_isuserdata(L, idx)) {
+        frame = luaH_webview_toframe(L, idx);
+    } else if (lua_toboolean(L, idx)) {
+        frame = webkit_web_view_get_focused_frame(view);
+    }
+
+    /* Fall back on main frame */
+    if (!frame)
+        frame = webkit_web_view_get_main_frame(view);
+    return frame;
+}
+
+/* Evaluates a script in the view:
+ *   view:eval_js(script, filename [, frame | focused | opts])
+ * where opts is a table with the optional fields:
+ *   frame      - frame to evaluate the script in
+ *   focused    - evaluate in the focused frame
+ *   structured - return the result as lua value instead of a string (and
+ *                nil plus the exception message on exception)
+ *   depth      - nesting limit of converted objects & arrays */
 static gint
 luaH_webview_eval_js(lua_State *L)
 {
-    WebKitWebFrame *frame = NULL;
     widget_t *w = luaH_checkwidget(L, 1);
     WebKitWebView *view = WEBKIT_WEB_VIEW(g_object_get_data(G_OBJECT(w->widget), "webview"));
     const gchar *script = luaL_checkstring(L, 2);
     const gchar *filename = luaL_checkstring(L, 3);
+    WebKitWebFrame *frame = luaH_webview_optframe(L, view, 4);
+    gboolean structured = FALSE;
+    gint depth = LUAJS_MAX_DEPTH;
+    gchar *error = NULL;
+
+    if (lua_istable(L, 4)) {
+        structured = luaH_getopt_boolean(L, 4, "structured", FALSE);
+        depth = luaH_getopt_number(L, 4, "depth", depth);
+    }
 
-    /* Check if js should be run on currently focused frame */
-    if (lua_gettop(L) >= 4) {
-        if (lua_islightuserdata(L, 4)) {
-            frame = lua_touserdata(L, 4);
-        } else if (lua_toboolean(L, 4)) {
-            frame = webkit_web_view_get_focused_frame(view);
+    /* evaluate javascript script and push return result onto lua stack */
+    JSValueRef result = webview_eval_js(frame, script, filename, &error);
+    gint ret = luaH_webview_push_js_result(L, frame, result, error,
+            structured, depth);
+    g_free(error);
+    return ret;
+}
+
+/* pending view:eval_js_async evaluation */
+typedef struct {
+    gchar *script;
+    gchar *file;
+    WebKitWebFrame *frame;
+    gboolean structured;
+    gint depth;
+    gpointer callback;
+} js_job_t;
+
+typedef struct {
+    GQueue jobs;
+    guint idle_id;
+} js_queue_t;
+
+/* time (in µs) spent evaluating queued scripts before returning to the main
+ * loop, a single long running script can't be interrupted though */
+#define JS_QUEUE_BUDGET 4000
+
+static void
+js_job_free(lua_State *L, js_job_t *job)
+{
+    luaH_object_unref(L, job->callback);
+    g_free(job->script);
+    g_free(job->file);
+    g_free(job);
+}
+
+/* Returns TRUE if the frame is still attached to the view */
+static gboolean
+webview_has_frame(WebKitWebView *v, WebKitWebFrame *f)
+{
+    gpointer hash = g_hash_table_lookup(frames_by_view, v);
+    return f == webkit_web_view_get_main_frame(v)
+        || (hash && g_hash_table_lookup_extended(hash, f, NULL, NULL));
+}
+
+static void
+js_job_complete(lua_State *L, js_job_t *job, WebKitWebView *v)
+{
+    gchar *error = NULL;
+    gint nargs;
+
+    if (!v) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "cancelled");
+        nargs = 2;
+    } else if (!webview_has_frame(v, job->frame)) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "frame destroyed");
+        nargs = 2;
+    } else {
+        JSValueRef result = webview_eval_js(job->frame, job->script,
+                job->file, &error);
+        nargs = luaH_webview_push_js_result(L, job->frame, result, error,
+                job->structured, job->depth);
+        /* always report exceptions, even for string results */
+        if (!result && nargs == 1) {
+            lua_pop(L, 1);
+            lua_pushnil(L);
+            lua_pushstring(L, error);
+            nargs = 2;
         }
+        g_free(error);
     }
-    /* Fall back on main frame */
-    if (!frame)
-        frame = webkit_web_view_get_main_frame(WEBKIT_WEB_VIEW(view));
 
-    /* evaluate javascript script and push return result onto lua stack */
-    const gchar *result = webview_eval_js(frame, script, filename);
-    lua_pushstring(L, result);
+    luaH_object_push(L, job->callback);
+    lua_insert(L, -nargs - 1);
+    if (lua_pcall(L, nargs, 0, 0)) {
+        warn("error in eval_js_async callback: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
+
+static gboolean
+js_queue_idle_cb(widget_t *w)
+{
+    lua_State *L = globalconf.L;
+    WebKitWebView *v = g_object_get_data(G_OBJECT(w->widget), "webview");
+    js_queue_t *q = g_object_get_data(G_OBJECT(w->widget), "js-queue");
+    gint64 start = g_get_monotonic_time();
+    guint idle_id = q->idle_id;
+    gboolean again = TRUE;
+    js_job_t *job;
+
+    /* a callback may destroy the view (which cancels the queue), keep the
+     * widget and the queue attached to it alive until we are done */
+    GObject *obj = g_object_ref(G_OBJECT(w->widget));
+
+    while ((job = g_queue_pop_head(&q->jobs))) {
+        js_job_complete(L, job, v);
+        js_job_free(L, job);
+        /* this source was removed by webview_cancel_js_jobs */
+        if (q->idle_id != idle_id) {
+            again = FALSE;
+            break;
+        }
+        if (g_get_monotonic_time() - start > JS_QUEUE_BUDGET)
+            break;
+    }
+
+    if (again && g_queue_is_empty(&q->jobs)) {
+        q->idle_id = 0;
+        again = FALSE;
+    }
+
+    g_object_unref(obj);
+    return again;
+}
+
+/* Cancels all pending eval_js_async evaluations of the view, the callbacks
+ * are called with nil and "cancelled". */
+static void
+webview_cancel_js_jobs(widget_t *w)
+{
+    lua_State *L = globalconf.L;
+    js_queue_t *q = g_object_get_data(G_OBJECT(w->widget), "js-queue");
+    js_job_t *job;
+
+    if (!q)
+        return;
+
+    if (q->idle_id) {
+        g_source_remove(q->idle_id);
+        q->idle_id = 0;
+    }
+
+    while ((job = g_queue_pop_head(&q->jobs))) {
+        js_job_complete(L, job, NULL);
+        js_job_free(L, job);
+    }
+}
+
+/* Queues a script for evaluation in an idle slice of the main loop:
+ *   view:eval_js_async(script, opts, callback)
+ * opts accepts the same fields as the eval_js options table plus "filename".
+ * The callback is called with the result or nil and the exception message,
+ * pending evaluations are cancelled when the view navigates away or is
+ * destroyed. */
+static gint
+luaH_webview_eval_js_async(lua_State *L)
+{
+    widget_t *w = luaH_checkwidget(L, 1);
+    WebKitWebView *view = WEBKIT_WEB_VIEW(g_object_get_data(G_OBJECT(w->widget), "webview"));
+    const gchar *script = luaL_checkstring(L, 2);
+    luaH_checkfunction(L, 4);
+
+    js_job_t *job = g_new0(js_job_t, 1);
+    job->script = g_strdup(script);
+    job->frame = luaH_webview_optframe(L, view, 3);
+    job->depth = LUAJS_MAX_DEPTH;
+
+    if (lua_istable(L, 3)) {
+        job->file = g_strdup(luaH_getopt_lstring(L, 3, "filename",
+                    "(eval_js_async)", NULL));
+        job->structured = luaH_getopt_boolean(L, 3, "structured", FALSE);
+        job->depth = luaH_getopt_number(L, 3, "depth", job->depth);
+    } else
+        job->file = g_strdup("(eval_js_async)");
+
+    lua_pushvalue(L, 4);
+    job->callback = luaH_object_ref(L, -1);
+
+    js_queue_t *q = g_object_get_data(G_OBJECT(w->widget), "js-queue");
+    if (!q) {
+        q = g_new0(js_queue_t, 1);
+        g_object_set_data_full(G_OBJECT(w->widget), "js-queue", q, g_free);
+    }
+
+    g_queue_push_tail(&q->jobs, job);
+    if (!q->idle_id)
+        q->idle_id = g_idle_add((GSourceFunc) js_queue_idle_cb, w);
+    return 0;
+}
+
+typedef struct {
+    JSContextRef context;
+    JSValueRef value;
+    gint depth;
+} webview_convert_t;
+
+static gint
+webview_convert_cb(lua_State *L)
+{
+    webview_convert_t *c = lua_touserdata(L, 1);
+    return luaJS_pushvalue(L, c->context, c->value, c->depth);
+}
+
+/* Evaluates a script in every frame of the view with a single call:
+ *   results, errors = view:eval_js_all_frames(script [, opts])
+ * opts accepts the "filename", "structured" and "depth" fields of the
+ * eval_js options table. Returns a list of { frame = f, result = r } tables
+ * in the order of view.frames and a table of exception messages by frame
+ * (for the frames which raised one or whose result couldn't be
+ * converted). */
+static gint
+luaH_webview_eval_js_all_frames(lua_State *L)
+{
+    widget_t *w = luaH_checkwidget(L, 1);
+    WebKitWebView *view = WEBKIT_WEB_VIEW(g_object_get_data(G_OBJECT(w->widget), "webview"));
+    const gchar *script = luaL_checkstring(L, 2);
+    const gchar *filename = "(eval_js_all_frames)";
+    gboolean structured = FALSE;
+    gint depth = LUAJS_MAX_DEPTH;
+    WebKitWebFrame *frame;
+    gchar *error;
+    gint n = 0;
+
+    if (lua_istable(L, 3)) {
+        filename = luaH_getopt_lstring(L, 3, "filename", filename, NULL);
+        structured = luaH_getopt_boolean(L, 3, "structured", FALSE);
+        depth = luaH_getopt_number(L, 3, "depth", depth);
+    }
+
+    lua_newtable(L);
+    gint results = lua_gettop(L);
+    lua_newtable(L);
+    gint errors = lua_gettop(L);
+
+    /* no frames until the first document is loaded */
+    GHashTable *frames = g_hash_table_lookup(frames_by_view, view);
+    if (!frames)
+        return 2;
+
+    /* the script is only converted once for all frames */
+    JSStringRef js_script = JSStringCreateWithUTF8CString(script);
+    JSStringRef js_file = JSStringCreateWithUTF8CString(filename);
+
+    /* scripts might destroy frames, so iterate over a copy (in the order
+     * of view.frames) */
+    GList *list = NULL;
+    GHashTableIter iter;
+    gpointer f;
+    g_hash_table_iter_init(&iter, frames);
+    while (g_hash_table_iter_next(&iter, &f, NULL))
+        list = g_list_prepend(list, f);
+    list = g_list_reverse(list);
+    for (GList *l = list; l; l = g_list_next(l)) {
+        frame = l->data;
+        if (!webview_has_frame(view, frame))
+            continue;
+
+        error = NULL;
+        JSValueRef result = webview_eval_jsstring(frame, js_script, js_file,
+                &error);
+        if (result && structured) {
+            /* the conversion may fail, which mustn't leak the list */
+            webview_convert_t c = {
+                .context = webkit_web_frame_get_global_context(frame),
+                .value = result,
+                .depth = depth,
+            };
+            lua_pushcfunction(L, webview_convert_cb);
+            lua_pushlightuserdata(L, &c);
+            if (lua_pcall(L, 1, 1, 0)) {
+                error = g_strdup(lua_tostring(L, -1));
+                lua_pop(L, 1);
+                result = NULL;
+            }
+        } else if (result)
+            luaH_webview_push_js_result(L, frame, result, NULL, FALSE, depth);
+
+        if (!result) {
+            luaH_frame_push(L, frame);
+            lua_pushstring(L, error);
+            lua_rawset(L, errors);
+            g_free(error);
+            continue;
+        }
+
+        /* results[n] = { frame = frame, result = <converted result> } */
+        lua_createtable(L, 0, 2);
+        lua_insert(L, -2);
+        lua_setfield(L, -2, "result");
+        luaH_frame_push(L, frame);
+        lua_setfield(L, -2, "frame");
+        lua_rawseti(L, results, ++n);
+    }
+
+    g_list_free(list);
+    JSStringRelease(js_script);
+    JSStringRelease(js_file);
+    return 2;
+}
+
+/* script registered with luakit.register_script */
+typedef struct {
+    gchar *id;
+    /* copy of the script source to detect unchanged re-registrations */
+    gchar *text;
+    size_t len;
+    /* the source is only converted once, not on every injection */
+    JSStringRef source;
+    JSStringRef file;
+    /* inject when the window object of a (main) frame is cleared */
+    gboolean document_start;
+    gboolean all_frames;
+    /* globs matched against the frame uri */
+    GPtrArray *include;
+    GPtrArray *exclude;
+} webview_script_t;
+
+/* registered scripts in registration order & by id */
+static GPtrArray *scripts = NULL;
+static GHashTable *scripts_by_id = NULL;
+
+static void
+webview_script_free(webview_script_t *s)
+{
+    g_ptr_array_free(s->include, TRUE);
+    g_ptr_array_free(s->exclude, TRUE);
+    JSStringRelease(s->source);
+    JSStringRelease(s->file);
+    g_free(s->text);
+    g_free(s->id);
+    g_free(s);
+}
+
+/* Raises an error if the field isn't a list of glob strings, must be called
+ * before anything is allocated */
+static void
+luaH_checkglobs(lua_State *L, gint idx, const gchar *name)
+{
+    lua_getfield(L, idx, name);
+    if (lua_istable(L, -1)) {
+        gint len = lua_objlen(L, -1);
+        for (gint i = 1; i <= len; i++) {
+            lua_rawgeti(L, -1, i);
+            luaL_checkstring(L, -1);
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+}
+
+/* Copies a list of glob strings checked with luaH_checkglobs */
+static GPtrArray*
+luaH_getglobs(lua_State *L, gint idx, const gchar *name)
+{
+    GPtrArray *globs = g_ptr_array_new_with_free_func(g_free);
+
+    lua_getfield(L, idx, name);
+    if (lua_istable(L, -1)) {
+        gint len = lua_objlen(L, -1);
+        for (gint i = 1; i <= len; i++) {
+            lua_rawgeti(L, -1, i);
+            g_ptr_array_add(globs, g_strdup(lua_tostring(L, -1)));
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+    return globs;
+}
+
+/* Matches a glob in which only '*' is special, the same as the patterns
+ * userscripts.lua builds from @include and @exclude */
+static gboolean
+glob_match(const gchar *glob, const gchar *str)
+{
+    const gchar *star = NULL, *back = NULL;
+
+    while (*str) {
+        if (*glob == '*') {
+            star = ++glob;
+            back = str;
+        } else if (*glob == *str) {
+            glob++;
+            str++;
+        } else if (star) {
+            glob = star;
+            str = ++back;
+        } else
+            return FALSE;
+    }
+    while (*glob == '*')
+        glob++;
+    return !*glob;
+}
+
+static gboolean
+match_globs(GPtrArray *globs, const gchar *uri)
+{
+    for (guint i = 0; i < globs->len; i++)
+        if (glob_match(g_ptr_array_index(globs, i), uri))
+            return TRUE;
+    return FALSE;
+}
+
+/* Registers (or replaces) a script which can then be injected into views by
+ * id or automatically at document start:
+ *   luakit.register_script{ id = "name", source = "js", filename = "file",
+ *       inject = "document-start", all_frames = false,
+ *       include = { "http://*" }, exclude = { "*.pdf" } }
+ * Only id and source are required, document-start scripts only run in frames
+ * matching one of the include globs ('*' matches anything, all other
+ * characters only themselves). Re-registering an unchanged source keeps
+ * the previously converted script. Returns true, or nil and the syntax error
+ * if the script doesn't parse. */
+gint
+luaH_webview_register_script(lua_State *L)
+{
+    static JSGlobalContextRef syntax_context = NULL;
+    size_t len;
+
+    luaH_checktable(L, 1);
+    const gchar *id = luaH_getopt_lstring(L, 1, "id", NULL, NULL);
+    const gchar *source = luaH_getopt_lstring(L, 1, "source", NULL, &len);
+    if (!id || !source)
+        luaL_error(L, "register_script: id and source required");
+    const gchar *file = luaH_getopt_lstring(L, 1, "filename", id, NULL);
+    const gchar *inject = luaH_getopt_lstring(L, 1, "inject", NULL, NULL);
+    gboolean all_frames = luaH_getopt_boolean(L, 1, "all_frames", FALSE);
+    luaH_checkglobs(L, 1, "include");
+    luaH_checkglobs(L, 1, "exclude");
+
+    if (!scripts) {
+        scripts = g_ptr_array_new();
+        scripts_by_id = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                (GDestroyNotify) webview_script_free);
+    }
+
+    webview_script_t *old = g_hash_table_lookup(scripts_by_id, id);
+    webview_script_t *s = g_new0(webview_script_t, 1);
+    s->id = g_strdup(id);
+    s->text = g_malloc(len);
+    memcpy(s->text, source, len);
+    s->len = len;
+    s->file = JSStringCreateWithUTF8CString(file);
+    s->document_start = !g_strcmp0(inject, "document-start");
+    s->all_frames = all_frames;
+    s->include = luaH_getglobs(L, 1, "include");
+    s->exclude = luaH_getglobs(L, 1, "exclude");
+
+    if (old && old->len == len && !memcmp(old->text, source, len))
+        s->source = JSStringRetain(old->source);
+    else {
+        s->source = JSStringCreateWithUTF8CString(source);
+
+        /* catch syntax errors once instead of on every injection */
+        if (!syntax_context)
+            syntax_context = JSGlobalContextCreate(NULL);
+        JSValueRef exc = NULL;
+        if (!JSCheckScriptSyntax(syntax_context, s->source, s->file, 1, &exc)) {
+            gchar *msg = luaJS_exception_message(syntax_context, exc);
+            lua_pushnil(L);
+            lua_pushstring(L, msg);
+            g_free(msg);
+            webview_script_free(s);
+            return 2;
+        }
+    }
+
+    if (old)
+        g_ptr_array_remove(scripts, old);
+    g_ptr_array_add(scripts, s);
+    g_hash_table_replace(scripts_by_id, s->id, s);
+
+    lua_pushboolean(L, TRUE);
     return 1;
 }
 
+gint
+luaH_webview_unregister_script(lua_State *L)
+{
+    const gchar *id = luaL_checkstring(L, 1);
+    webview_script_t *s = scripts_by_id ? g_hash_table_lookup(scripts_by_id, id) : NULL;
+    if (s) {
+        g_ptr_array_remove(scripts, s);
+        g_hash_table_remove(scripts_by_id, id);
+    }
+    lua_pushboolean(L, s != NULL);
+    return 1;
+}
+
+/* Injects a registered script into the view:
+ *   view:inject_script(id [, frame | focused | opts])
+ * takes the same frame & options argument as eval_js and returns the same
+ * results. */
+static gint
+luaH_webview_inject_script(lua_State *L)
+{
+    widget_t *w = luaH_checkwidget(L, 1);
+    WebKitWebView *view = WEBKIT_WEB_VIEW(g_object_get_data(G_OBJECT(w->widget), "webview"));
+    const gchar *id = luaL_checkstring(L, 2);
+    WebKitWebFrame *frame = luaH_webview_optframe(L, view, 3);
+    gboolean structured = FALSE;
+    gint depth = LUAJS_MAX_DEPTH;
+    gchar *error = NULL;
+
+    webview_script_t *s = scripts_by_id ? g_hash_table_lookup(scripts_by_id, id) : NULL;
+    if (!s)
+        return luaL_error(L, "inject_script: no script registered as %s", id);
+
+    if (lua_istable(L, 3)) {
+        structured = luaH_getopt_boolean(L, 3, "structured", FALSE);
+        depth = luaH_getopt_number(L, 3, "depth", depth);
+    }
+
+    JSValueRef result = webview_eval_jsstring(frame, s->source, s->file, &error);
+    gint ret = luaH_webview_push_js_result(L, frame, result, error,
+            structured, depth);
+    g_free(error);
+    return ret;
+}
+
+static void
+window_object_cleared_cb(WebKitWebView *v, WebKitWebFrame *f,
+        JSGlobalContextRef context, JSObjectRef window, widget_t *w)
+{
+    (void) context;
+    (void) window;
+    (void) w;
+    webview_script_t *s;
+
+    if (!scripts)
+        return;
+
+    gboolean is_main = (f == webkit_web_view_get_main_frame(v));
+    const gchar *uri = NONULL(webkit_web_frame_get_uri(f));
+
+    for (guint i = 0; i < scripts->len; i++) {
+        s = g_ptr_array_index(scripts, i);
+        if (!s->document_start || !(is_main || s->all_frames))
+            continue;
+        if (!match_globs(s->include, uri) || match_globs(s->exclude, uri))
+            continue;
+        webview_eval_jsstring(f, s->source, s->file, NULL);
+    }
+}
+
 static void
 notify_cb(WebKitWebView *v, GParamSpec *ps, widget_t *w)
 {
@@ -356,23 +1047,224 @@ frame_destroyed_cb(frame_destroy_callback_t *d)
     g_free(d);
 }
 
+static gint
+luaH_webview_push_frames(lua_State *L, WebKitWebView *v)
+{
+    GHashTable *hash = g_hash_table_lookup(frames_by_view, v);
+    GHashTableIter iter;
+    gpointer f;
+    gint i = 0;
+
+    lua_createtable(L, g_hash_table_size(hash), 0);
+    g_hash_table_iter_init(&iter, hash);
+    while (g_hash_table_iter_next(&iter, &f, NULL)) {
+        luaH_frame_push(L, f);
+        lua_rawseti(L, -2, ++i);
+    }
+    return 1;
+}
+
+/* Iterator closure of view:each_frame(), the upvalues are the view and the
+ * number of frames already visited. Frames are few so skipping over the
+ * visited ones is cheaper than building a table for every loop. */
+static gint
+luaH_webview_each_frame_next(lua_State *L)
+{
+    WebKitWebView *v = lua_touserdata(L, lua_upvalueindex(1));
+    gint n = lua_tointeger(L, lua_upvalueindex(2));
+    /* the view might have been destroyed while iterating */
+    GHashTable *hash = g_hash_table_lookup(frames_by_view, v);
+    GHashTableIter iter;
+    gpointer f;
+    gint i = 0;
+
+    if (!hash)
+        return 0;
+
+    g_hash_table_iter_init(&iter, hash);
+    while (g_hash_table_iter_next(&iter, &f, NULL)) {
+        if (i++ < n)
+            continue;
+        lua_pushinteger(L, i);
+        lua_replace(L, lua_upvalueindex(2));
+        return luaH_frame_push(L, f);
+    }
+    return 0;
+}
+
+/* Returns an iterator over the frames of the view:
+ *   for frame in view:each_frame() do ... end */
+static gint
+luaH_webview_each_frame(lua_State *L)
+{
+    widget_t *w = luaH_checkwidget(L, 1);
+    lua_pushlightuserdata(L, g_object_get_data(G_OBJECT(w->widget), "webview"));
+    lua_pushinteger(L, 0);
+    lua_pushcclosure(L, luaH_webview_each_frame_next, 2);
+    return 1;
+}
+
 static void
-luaH_push_frame(gpointer f, gpointer v, gpointer L)
+webview_load_timing_free(webview_load_timing_t *lt)
 {
-    (void) v;
-    lua_pushlightuserdata((lua_State *)L, f);
+    g_free(lt->current.uri);
+    g_free(lt->last.uri);
+    g_free(lt);
+}
+
+static webview_load_timing_t*
+webview_load_timing_get(widget_t *w)
+{
+    webview_load_timing_t *lt = g_object_get_data(G_OBJECT(w->widget), "load-timing");
+    if (!lt) {
+        lt = g_new0(webview_load_timing_t, 1);
+        g_object_set_data_full(G_OBJECT(w->widget), "load-timing", lt,
+                (GDestroyNotify) webview_load_timing_free);
+    }
+    return lt;
+}
+
+static void
+load_timing_record(load_timing_t *t)
+{
+    SoupURI *uri = t->uri ? soup_uri_new(t->uri) : NULL;
+    const gchar *host = uri && uri->host ? uri->host : "";
+
+    if (!load_timing_by_host)
+        load_timing_by_host = g_hash_table_new_full(g_str_hash, g_str_equal,
+                g_free, g_free);
+
+    host_load_timing_t *h = g_hash_table_lookup(load_timing_by_host, host);
+    if (!h) {
+        h = g_new0(host_load_timing_t, 1);
+        g_hash_table_insert(load_timing_by_host, g_strdup(host), h);
+    }
+
+    h->loads++;
+    if (t->failed) {
+        h->failed++;
+    } else {
+        if (t->committed)
+            histogram_add(&h->committed,
+                    ELAPSED_MS(t->provisional, t->committed));
+        if (t->first_visual)
+            histogram_add(&h->first_visual,
+                    ELAPSED_MS(t->provisional, t->first_visual));
+        histogram_add(&h->finished, ELAPSED_MS(t->provisional, t->finished));
+    }
+
+    if (uri)
+        soup_uri_free(uri);
+}
+
+/* Records the time of each load phase of the current navigation */
+static void
+webview_load_timing_update(widget_t *w, WebKitWebView *v, WebKitLoadStatus status)
+{
+    webview_load_timing_t *lt = webview_load_timing_get(w);
+    load_timing_t *t = &lt->current;
+    gint64 now = g_get_monotonic_time();
+
+    if (status == WEBKIT_LOAD_PROVISIONAL) {
+        g_free(t->uri);
+        memset(t, 0, sizeof(load_timing_t));
+        t->provisional = now;
+        return;
+    }
+
+    /* ignore phases of loads we haven't seen start or already finished */
+    if (!t->provisional || t->finished)
+        return;
+
+    switch (status) {
+      case WEBKIT_LOAD_COMMITTED:
+        t->committed = now;
+        t->uri = g_strdup(webkit_web_view_get_uri(v));
+        break;
+
+      case WEBKIT_LOAD_FIRST_VISUALLY_NON_EMPTY_LAYOUT:
+        t->first_visual = now;
+        break;
+
+      case WEBKIT_LOAD_FAILED:
+        t->failed = TRUE;
+        /* fall through */
+      case WEBKIT_LOAD_FINISHED:
+        t->finished = now;
+        load_timing_record(t);
+        /* keep the completed navigation around for lua */
+        g_free(lt->last.uri);
+        lt->last = *t;
+        t->uri = NULL;
+        break;
+
+      default:
+        break;
+    }
 }
 
 static gint
-luaH_webview_push_frames(lua_State *L, WebKitWebView *v)
+luaH_webview_push_load_timing(lua_State *L, widget_t *w)
 {
-    gpointer hash = g_hash_table_lookup(frames_by_view, v);
-    gint size = g_hash_table_size(hash);
-    lua_createtable(L, size, 0);
-    gint top = lua_gettop(L);
-    g_hash_table_foreach(hash, luaH_push_frame, L);
-    for (int i = 1; i <= size; ++i) {
-        lua_rawseti(L, top, i);
+    webview_load_timing_t *lt = g_object_get_data(G_OBJECT(w->widget), "load-timing");
+    load_timing_t *t = lt ? &lt->last : NULL;
+    if (!t || !t->finished)
+        return 0;
+
+    lua_createtable(L, 0, 6);
+    lua_pushliteral(L, "uri");
+    lua_pushstring(L, t->uri);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "resources");
+    lua_pushnumber(L, t->resources);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "failed");
+    lua_pushboolean(L, t->failed);
+    lua_rawset(L, -3);
+
+    luaH_pushelapsedfield(L, "committed",    t->provisional, t->committed);
+    luaH_pushelapsedfield(L, "first_visual", t->provisional, t->first_visual);
+    luaH_pushelapsedfield(L, "finished",     t->provisional, t->finished);
+
+    return 1;
+}
+
+/* Pushes the load phase timings of all navigations by host:
+ *   luakit.load_timing() -> { [host] = { loads = n, failed = n,
+ *       committed = histogram, first_visual = histogram,
+ *       finished = histogram } }
+ * with the histograms in ms since the start of the navigation. */
+gint
+luaH_webview_push_host_load_timing(lua_State *L)
+{
+    GHashTableIter iter;
+    gpointer host, data;
+
+    lua_newtable(L);
+    if (!load_timing_by_host)
+        return 1;
+
+    g_hash_table_iter_init(&iter, load_timing_by_host);
+    while (g_hash_table_iter_next(&iter, &host, &data)) {
+        host_load_timing_t *h = data;
+        lua_pushstring(L, host);
+        lua_createtable(L, 0, 5);
+        lua_pushliteral(L, "loads");
+        lua_pushnumber(L, h->loads);
+        lua_rawset(L, -3);
+        lua_pushliteral(L, "failed");
+        lua_pushnumber(L, h->failed);
+        lua_rawset(L, -3);
+        lua_pushliteral(L, "committed");
+        luaH_histogram_push(L, &h->committed);
+        lua_rawset(L, -3);
+        lua_pushliteral(L, "first_visual");
+        luaH_histogram_push(L, &h->first_visual);
+        lua_rawset(L, -3);
+        lua_pushliteral(L, "finished");
+        luaH_histogram_push(L, &h->finished);
+        lua_rawset(L, -3);
+        lua_rawset(L, -3);
     }
     return 1;
 }
@@ -407,11 +1299,25 @@ notify_load_status_cb(WebKitWebView *v, GParamSpec *ps, widget_t *w)
     if ((status & WEBKIT_LOAD_COMMITTED) || (status & WEBKIT_LOAD_FINISHED))
         update_uri(w, NULL);
 
+    /* results of scripts queued for the old page are meaningless */
+    if (status == WEBKIT_LOAD_PROVISIONAL)
+        webview_cancel_js_jobs(w);
+
+    webview_load_timing_update(w, v, status);
+
+    if (name)
+        trace_instant("load-status", name);
+
     lua_State *L = globalconf.L;
     luaH_object_push(L, w->ref);
     lua_pushstring(L, name);
     luaH_object_emit_signal(L, -2, "load-status", 1, 0);
     lua_pop(L, 1);
+
+    /* the startup trace ends with the first painted (or failed) page */
+    if (status == WEBKIT_LOAD_FIRST_VISUALLY_NON_EMPTY_LAYOUT
+            || status == WEBKIT_LOAD_FINISHED || status == WEBKIT_LOAD_FAILED)
+        trace_write();
 }
 
 static gboolean
@@ -474,9 +1380,22 @@ resource_request_starting_cb(WebKitWebView *v, WebKitWebFrame *f,
     lua_pushstring(L, uri);
     gint ret = luaH_object_emit_signal(L, -2, "resource-request-starting", 1, 1);
 
-    if (ret && !lua_toboolean(L, -1))
+    webview_stats_t *stats = webview_stats_get(w);
+    stats->requests++;
+
+    /* count the resources of the navigation in progress */
+    webview_load_timing_t *lt = webview_load_timing_get(w);
+    if (lt->current.provisional && !lt->current.finished)
+        lt->current.resources++;
+
+    if (ret && !lua_toboolean(L, -1)) {
         /* User responded with false, ignore request */
         webkit_network_request_set_uri(r, "about:blank");
+        stats->blocked++;
+    } else {
+        /* let the soup features know which view started the request */
+        soup_request_set_view(webkit_network_request_get_uri(r), w);
+    }
 
     lua_pop(L, ret + 1);
     return TRUE;
@@ -585,6 +1504,8 @@ link_hover_cb(WebKitWebView *view, const gchar *t, const gchar *link, widget_t *
         lua_pushstring(L, link);
         g_object_set_data_full(ws, "hovered-uri", g_strdup(link), g_free);
         luaH_object_emit_signal(L, -2, "link-hover", 1, 0);
+        /* the user is likely to click it, warm up the host */
+        soup_prefetch_uri(link, TRUE);
     }
 
     luaH_object_emit_signal(L, -1, "property::hovered_uri", 0, 0);
@@ -942,6 +1863,317 @@ webview_set_history(lua_State *L, WebKitWebView *view, gint idx)
     lua_pop(L, 1);
 }
 
+static GtkWidget *webview_create_view(widget_t *w);
+
+static void
+webview_discarded_free(webview_discarded_t *d)
+{
+    if (d->history)
+        luaH_object_unref(globalconf.L, d->history);
+    g_free(d->title);
+    g_free(d);
+}
+
+static void
+webview_discarded_clear(widget_t *w, GtkWidget *view)
+{
+    webview_discarded_t *d = g_object_get_data(G_OBJECT(w->widget), "discarded");
+    if (d) {
+        g_signal_handlers_disconnect_matched(view, G_SIGNAL_MATCH_DATA,
+                0, 0, NULL, NULL, d);
+        g_object_set_data(G_OBJECT(w->widget), "discarded", NULL);
+    }
+}
+
+/* Tracks the first load of a discarded view. Loading anything but the saved
+ * history makes the view a regular view again, restoring it puts the scroll
+ * position back once the page has finished loading. */
+static void
+discarded_load_status_cb(WebKitWebView *v, GParamSpec *ps, webview_discarded_t *d)
+{
+    (void) ps;
+    WebKitLoadStatus status;
+    g_object_get(G_OBJECT(v), "load-status", &status, NULL);
+    widget_t *w = g_object_get_data(G_OBJECT(gtk_widget_get_parent(GTK_WIDGET(v))),
+            "lua_widget");
+
+    switch (status) {
+      case WEBKIT_LOAD_PROVISIONAL:
+        if (!d->restoring || d->loading)
+            webview_discarded_clear(w, GTK_WIDGET(v));
+        else
+            d->loading = TRUE;
+        break;
+
+      case WEBKIT_LOAD_FINISHED:
+        adjustment_set(gtk_scrolled_window_get_hadjustment(
+                    GTK_SCROLLED_WINDOW(w->widget)), d->scroll_horiz);
+        adjustment_set(gtk_scrolled_window_get_vadjustment(
+                    GTK_SCROLLED_WINDOW(w->widget)), d->scroll_vert);
+        webview_discarded_clear(w, GTK_WIDGET(v));
+        break;
+
+      case WEBKIT_LOAD_FAILED:
+        webview_discarded_clear(w, GTK_WIDGET(v));
+        break;
+
+      default:
+        break;
+    }
+}
+
+/* Pushes the history table of a single page */
+static gint
+luaH_push_single_history(lua_State *L, const gchar *uri, const gchar *title)
+{
+    lua_createtable(L, 0, 2);
+    lua_pushliteral(L, "index");
+    lua_pushnumber(L, 1);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "items");
+    lua_createtable(L, 1, 0);
+    lua_createtable(L, 0, 2);
+    lua_pushliteral(L, "uri");
+    lua_pushstring(L, uri);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "title");
+    lua_pushstring(L, NONULL(title));
+    lua_rawset(L, -3);
+    lua_rawseti(L, -2, 1);
+    lua_rawset(L, -3);
+    return 1;
+}
+
+/* Frees the page of an inactive view by replacing its WebKitWebView with an
+ * empty one. The history, scroll position and title are saved so the view
+ * can be restored later, the widget itself (and so the lua object) stays the
+ * same. Returns FALSE if the view is visible or already discarded.
+ *
+ * If there is a table at `idx` the saved state is taken from its "history"
+ * (or "uri") and "title" fields instead of the view, which allows creating
+ * placeholder tabs which only load once they are shown. */
+static gboolean
+webview_discard(lua_State *L, widget_t *w, gint idx)
+{
+    GtkWidget *old = g_object_get_data(G_OBJECT(w->widget), "webview");
+    gchar *uri = NULL;
+
+    if (lua_istable(L, idx)) {
+        lua_getfield(L, idx, "history");
+        if (!lua_istable(L, -1) && !luaH_getopt_lstring(L, idx, "uri", NULL, NULL))
+            luaL_error(L, "discard: history or uri expected");
+        lua_pop(L, 1);
+    }
+
+    if (g_object_get_data(G_OBJECT(w->widget), "discarded")
+            || gtk_widget_get_mapped(w->widget))
+        return FALSE;
+
+    webview_cancel_js_jobs(w);
+
+    webview_discarded_t *d = g_new0(webview_discarded_t, 1);
+    if (lua_istable(L, idx)) {
+        uri = g_strdup(luaH_getopt_lstring(L, idx, "uri", NULL, NULL));
+        d->title = g_strdup(luaH_getopt_lstring(L, idx, "title", NULL, NULL));
+        lua_getfield(L, idx, "history");
+        if (!lua_istable(L, -1)) {
+            lua_pop(L, 1);
+            luaH_push_single_history(L, uri, d->title);
+        } else if (!uri) {
+            /* use the uri of the current history item */
+            lua_getfield(L, -1, "items");
+            if (lua_istable(L, -1)) {
+                lua_getfield(L, -2, "index");
+                lua_gettable(L, -2);
+                if (lua_istable(L, -1))
+                    uri = g_strdup(luaH_getopt_lstring(L, -1, "uri", NULL, NULL));
+                lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+        }
+        d->history = luaH_object_ref(L, -1);
+    } else {
+        luaH_webview_push_history(L, WEBKIT_WEB_VIEW(old));
+        d->history = luaH_object_ref(L, -1);
+        d->title = g_strdup(webkit_web_view_get_title(WEBKIT_WEB_VIEW(old)));
+    }
+    d->scroll_horiz = gtk_adjustment_get_value(
+            gtk_scrolled_window_get_hadjustment(GTK_SCROLLED_WINDOW(w->widget)));
+    d->scroll_vert = gtk_adjustment_get_value(
+            gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(w->widget)));
+
+    /* carry the settings & state lua might have set over to the new view */
+    WebKitWebSettings *settings = g_object_ref(
+            webkit_web_view_get_settings(WEBKIT_WEB_VIEW(old)));
+    gfloat zoom = webkit_web_view_get_zoom_level(WEBKIT_WEB_VIEW(old));
+    gboolean full_zoom = webkit_web_view_get_full_content_zoom(WEBKIT_WEB_VIEW(old));
+    gboolean scrollbars = !g_object_get_data(G_OBJECT(old), "hide_handler_id");
+    if (!uri)
+        uri = g_strdup(g_object_get_data(G_OBJECT(old), "uri"));
+
+    gtk_widget_destroy(old);
+    g_hash_table_remove(frames_by_view, old);
+
+    GtkWidget *view = webview_create_view(w);
+    webkit_web_view_set_settings(WEBKIT_WEB_VIEW(view), settings);
+    g_object_unref(settings);
+    webkit_web_view_set_full_content_zoom(WEBKIT_WEB_VIEW(view), full_zoom);
+    webkit_web_view_set_zoom_level(WEBKIT_WEB_VIEW(view), zoom);
+    g_object_set_data_full(G_OBJECT(view), "uri", uri, g_free);
+    show_scrollbars(w, scrollbars);
+
+    g_object_set_data_full(G_OBJECT(w->widget), "discarded", d,
+            (GDestroyNotify) webview_discarded_free);
+    g_signal_connect(G_OBJECT(view), "notify::load-status",
+            G_CALLBACK(discarded_load_status_cb), d);
+    return TRUE;
+}
+
+/* Loads the saved history of a discarded view. Returns FALSE if the view
+ * isn't discarded. */
+static gboolean
+webview_restore(lua_State *L, widget_t *w)
+{
+    GtkWidget *view = g_object_get_data(G_OBJECT(w->widget), "webview");
+    webview_discarded_t *d = g_object_get_data(G_OBJECT(w->widget), "discarded");
+    if (!d || d->restoring)
+        return FALSE;
+
+    d->restoring = TRUE;
+    luaH_object_push(L, d->history);
+    luaH_object_unref(L, d->history);
+    d->history = NULL;
+    webview_set_history(L, WEBKIT_WEB_VIEW(view), lua_gettop(L));
+    lua_pop(L, 1);
+    return TRUE;
+}
+
+static gint
+luaH_webview_discard(lua_State *L)
+{
+    widget_t *w = luaH_checkwidget(L, 1);
+    lua_pushboolean(L, webview_discard(L, w, 2));
+    return 1;
+}
+
+static gint
+luaH_webview_restore(lua_State *L)
+{
+    widget_t *w = luaH_checkwidget(L, 1);
+    lua_pushboolean(L, webview_restore(L, w));
+    return 1;
+}
+
+static void
+webview_map_cb(GtkWidget *widget, widget_t *w)
+{
+    (void) widget;
+    webview_restore(globalconf.L, w);
+}
+
+static JSValueRef
+js_get_property(JSContextRef context, JSValueRef value, const gchar *name)
+{
+    if (!value || !JSValueIsObject(context, value))
+        return NULL;
+    JSStringRef js_name = JSStringCreateWithUTF8CString(name);
+    JSValueRef ret = JSObjectGetProperty(context, (JSObjectRef) value,
+            js_name, NULL);
+    JSStringRelease(js_name);
+    return ret;
+}
+
+/* Adds the javascript heap size of the main frame to the table on top of
+ * the stack. JavaScriptCore only exposes this through the non-standard
+ * performance.memory object so the fields are missing when it's not
+ * available. */
+static void
+luaH_webview_push_js_heap(lua_State *L, WebKitWebView *v)
+{
+    WebKitWebFrame *frame = webkit_web_view_get_main_frame(v);
+    JSGlobalContextRef context = webkit_web_frame_get_global_context(frame);
+    JSValueRef memory = js_get_property(context,
+            js_get_property(context, JSContextGetGlobalObject(context),
+                "performance"), "memory");
+
+#define PUSH_HEAP(field, name)                                                \
+    if ((tmp = js_get_property(context, memory, name))                        \
+            && JSValueIsNumber(context, tmp)) {                               \
+        lua_pushliteral(L, field);                                            \
+        lua_pushnumber(L, JSValueToNumber(context, tmp, NULL));               \
+        lua_rawset(L, -3);                                                    \
+    }
+
+    JSValueRef tmp;
+    PUSH_HEAP("js_heap_used",  "usedJSHeapSize")
+    PUSH_HEAP("js_heap_total", "totalJSHeapSize")
+
+#undef PUSH_HEAP
+}
+
+/* Pushes the resource usage counters of the view */
+static gint
+luaH_webview_push_stats(lua_State *L, widget_t *w)
+{
+    GtkWidget *view = g_object_get_data(G_OBJECT(w->widget), "webview");
+    webview_stats_t *stats = webview_stats_get(w);
+    netstats_t *net = netstats_view_total(w);
+
+    lua_createtable(L, 0, 9);
+
+    luaH_pushnumfield(L, "requests", stats->requests);
+    luaH_pushnumfield(L, "blocked",  stats->blocked);
+    luaH_pushnumfield(L, "bytes",    net ? net->bytes : 0);
+    luaH_pushnumfield(L, "failed",   net ? net->failed : 0);
+    luaH_pushnumfield(L, "js_evals", stats->js_evals);
+    luaH_pushnumfield(L, "js_time",  stats->js_time);
+
+    lua_pushliteral(L, "discarded");
+    lua_pushboolean(L, g_object_get_data(G_OBJECT(w->widget), "discarded") != NULL);
+    lua_rawset(L, -3);
+
+    luaH_webview_push_js_heap(L, WEBKIT_WEB_VIEW(view));
+    return 1;
+}
+
+/* Pushes the resource usage of all views:
+ *   luakit.stats() -> { views = { { view = view, requests = ..., ... }, ... },
+ *                       requests = ..., bytes = ..., ... }
+ * where the fields outside of `views` hold the sum over all views. */
+gint
+luaH_webview_push_all_stats(lua_State *L)
+{
+    static const gchar *fields[] = { "requests", "blocked", "bytes", "failed",
+        "js_evals", "js_time", "js_heap_used", "js_heap_total", NULL };
+    gdouble totals[G_N_ELEMENTS(fields)] = { 0 };
+    guint n = globalconf.webviews ? globalconf.webviews->len : 0;
+
+    lua_createtable(L, 0, G_N_ELEMENTS(fields));
+    lua_pushliteral(L, "views");
+    lua_createtable(L, n, 0);
+    for (guint i = 0; i < n; i++) {
+        widget_t *w = g_ptr_array_index(globalconf.webviews, i);
+        luaH_webview_push_stats(L, w);
+        for (gint f = 0; fields[f]; f++) {
+            lua_getfield(L, -1, fields[f]);
+            totals[f] += lua_tonumber(L, -1);
+            lua_pop(L, 1);
+        }
+        lua_pushliteral(L, "view");
+        luaH_object_push(L, w->ref);
+        lua_rawset(L, -3);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_rawset(L, -3);
+
+    for (gint f = 0; fields[f]; f++) {
+        lua_pushstring(L, fields[f]);
+        lua_pushnumber(L, totals[f]);
+        lua_rawset(L, -3);
+    }
+    return 1;
+}
+
 static gint
 luaH_webview_can_go_back(lua_State *L)
 {
@@ -965,6 +2197,7 @@ luaH_webview_index(lua_State *L, luakit_token_t token)
 {
     widget_t *w = luaH_checkwidget(L, 1);
     GtkWidget *view = g_object_get_data(G_OBJECT(w->widget), "webview");
+    webview_discarded_t *d = g_object_get_data(G_OBJECT(w->widget), "discarded");
     property_tmp_value_t tmp;
 
     switch(token)
@@ -989,6 +2222,10 @@ luaH_webview_index(lua_State *L, luakit_token_t token)
       PF_CASE(CAN_GO_FORWARD,       luaH_webview_can_go_forward)
       /* push misc webview methods */
       PF_CASE(EVAL_JS,              luaH_webview_eval_js)
+      PF_CASE(EVAL_JS_ASYNC,        luaH_webview_eval_js_async)
+      PF_CASE(EVAL_JS_ALL_FRAMES,   luaH_webview_eval_js_all_frames)
+      PF_CASE(EACH_FRAME,           luaH_webview_each_frame)
+      PF_CASE(INJECT_SCRIPT,        luaH_webview_inject_script)
       PF_CASE(REGISTER_FUNCTION,    luaH_webview_register_function)
       PF_CASE(LOAD_STRING,          luaH_webview_load_string)
       PF_CASE(LOADING,              luaH_webview_loading)
@@ -996,6 +2233,8 @@ luaH_webview_index(lua_State *L, luakit_token_t token)
       PF_CASE(RELOAD_BYPASS_CACHE,  luaH_webview_reload_bypass_cache)
       PF_CASE(SSL_TRUSTED,          luaH_webview_ssl_trusted)
       PF_CASE(STOP,                 luaH_webview_stop)
+      PF_CASE(DISCARD,              luaH_webview_discard)
+      PF_CASE(RESTORE,              luaH_webview_restore)
       /* push source viewing methods */
       PF_CASE(GET_VIEW_SOURCE,      luaH_webview_get_view_source)
       PF_CASE(SET_VIEW_SOURCE,      luaH_webview_set_view_source)
@@ -1012,8 +2251,25 @@ luaH_webview_index(lua_State *L, luakit_token_t token)
         return 1;
 
       case L_TK_HISTORY:
+        if (d && !d->restoring) {
+            luaH_object_push(L, d->history);
+            return 1;
+        }
         return luaH_webview_push_history(L, WEBKIT_WEB_VIEW(view));
 
+      case L_TK_DISCARDED:
+        lua_pushboolean(L, d && !d->restoring);
+        return 1;
+
+      case L_TK_NETWORK_STATS:
+        return luaH_netstats_push_view(L, w);
+
+      case L_TK_STATS:
+        return luaH_webview_push_stats(L, w);
+
+      case L_TK_LOAD_TIMING:
+        return luaH_webview_push_load_timing(L, w);
+
       default:
         break;
     }
@@ -1257,10 +2513,48 @@ populate_popup_cb(WebKitWebView *v, GtkMenu *menu, widget_t *w)
     lua_pop(L, ret + 1);
 }
 
+/* Creates the WebKitWebView of the webview widget */
+static GtkWidget*
+webview_create_view(widget_t *w)
+{
+    GtkWidget *view = webkit_web_view_new();
+    g_object_set_data(G_OBJECT(w->widget), "webview", view);
+    gtk_container_add(GTK_CONTAINER(w->widget), view);
+    g_hash_table_insert(frames_by_view, view, g_hash_table_new(g_direct_hash, g_direct_equal));
+
+    /* connect webview signals */
+    g_object_connect(G_OBJECT(view),
+      "signal::button-press-event",                   G_CALLBACK(webview_button_cb),            w,
+      "signal::button-release-event",                 G_CALLBACK(webview_button_cb),            w,
+      "signal::create-web-view",                      G_CALLBACK(create_web_view_cb),           w,
+      "signal::download-requested",                   G_CALLBACK(download_request_cb),          w,
+      "signal::expose-event",                         G_CALLBACK(expose_cb),                    w,
+      "signal::focus-in-event",                       G_CALLBACK(focus_cb),                     w,
+      "signal::focus-out-event",                      G_CALLBACK(focus_cb),                     w,
+      "signal::hovering-over-link",                   G_CALLBACK(link_hover_cb),                w,
+      "signal::key-press-event",                      G_CALLBACK(key_press_cb),                 w,
+      "signal::mime-type-policy-decision-requested",  G_CALLBACK(mime_type_decision_cb),        w,
+      "signal::navigation-policy-decision-requested", G_CALLBACK(navigation_decision_cb),       w,
+      "signal::new-window-policy-decision-requested", G_CALLBACK(new_window_decision_cb),       w,
+      "signal::notify",                               G_CALLBACK(notify_cb),                    w,
+      "signal::notify::load-status",                  G_CALLBACK(notify_load_status_cb),        w,
+      "signal::parent-set",                           G_CALLBACK(parent_set_cb),                w,
+      "signal::populate-popup",                       G_CALLBACK(populate_popup_cb),            w,
+      "signal::resource-request-starting",            G_CALLBACK(resource_request_starting_cb), w,
+      "signal::window-object-cleared",                G_CALLBACK(window_object_cleared_cb),     w,
+      "signal::document-load-finished",               G_CALLBACK(document_load_finished_cb),    w,
+      NULL);
+
+    gtk_widget_show(view);
+    return view;
+}
+
 static void
 webview_destructor(widget_t *w)
 {
+    webview_cancel_js_jobs(w);
     g_ptr_array_remove(globalconf.webviews, w);
+    soup_view_detach(w);
     GtkWidget *view = g_object_get_data(G_OBJECT(w->widget), "webview");
     gtk_widget_destroy(GTK_WIDGET(view));
     gtk_widget_destroy(GTK_WIDGET(w->widget));
@@ -1287,43 +2581,23 @@ widget_webview(widget_t *w)
         frames_by_view = g_hash_table_new_full(g_direct_hash, g_direct_equal,
             NULL, (GDestroyNotify) g_hash_table_destroy);
 
-    GtkWidget *view = webkit_web_view_new();
     w->widget = gtk_scrolled_window_new(NULL, NULL);
     g_object_set_data(G_OBJECT(w->widget), "lua_widget", w);
-    g_object_set_data(G_OBJECT(w->widget), "webview", view);
-    gtk_container_add(GTK_CONTAINER(w->widget), view);
+    trace_begin("startup", "webview");
+    webview_create_view(w);
+    trace_end("startup", "webview");
 
     /* set initial scrollbars state */
     show_scrollbars(w, TRUE);
 
     /* insert data into global tables and arrays */
     g_ptr_array_add(globalconf.webviews, w);
-    g_hash_table_insert(frames_by_view, view, g_hash_table_new(g_direct_hash, g_direct_equal));
+    soup_view_attach(w);
 
-    /* connect webview signals */
-    g_object_connect(G_OBJECT(view),
-      "signal::button-press-event",                   G_CALLBACK(webview_button_cb),            w,
-      "signal::button-release-event",                 G_CALLBACK(webview_button_cb),            w,
-      "signal::create-web-view",                      G_CALLBACK(create_web_view_cb),           w,
-      "signal::download-requested",                   G_CALLBACK(download_request_cb),          w,
-      "signal::expose-event",                         G_CALLBACK(expose_cb),                    w,
-      "signal::focus-in-event",                       G_CALLBACK(focus_cb),                     w,
-      "signal::focus-out-event",                      G_CALLBACK(focus_cb),                     w,
-      "signal::hovering-over-link",                   G_CALLBACK(link_hover_cb),                w,
-      "signal::key-press-event",                      G_CALLBACK(key_press_cb),                 w,
-      "signal::mime-type-policy-decision-requested",  G_CALLBACK(mime_type_decision_cb),        w,
-      "signal::navigation-policy-decision-requested", G_CALLBACK(navigation_decision_cb),       w,
-      "signal::new-window-policy-decision-requested", G_CALLBACK(new_window_decision_cb),       w,
-      "signal::notify",                               G_CALLBACK(notify_cb),                    w,
-      "signal::notify::load-status",                  G_CALLBACK(notify_load_status_cb),        w,
-      "signal::parent-set",                           G_CALLBACK(parent_set_cb),                w,
-      "signal::populate-popup",                       G_CALLBACK(populate_popup_cb),            w,
-      "signal::resource-request-starting",            G_CALLBACK(resource_request_starting_cb), w,
-      "signal::document-load-finished",               G_CALLBACK(document_load_finished_cb),    w,
-      NULL);
+    /* restore discarded views when their tab is shown */
+    g_signal_connect(G_OBJECT(w->widget), "map", G_CALLBACK(webview_map_cb), w);
 
     /* show widgets */
-    gtk_widget_show(view);
     gtk_widget_show(w->widget);
 
     return w;
@@ -0,0 +1,33 @@
+/*
+ * widgets/webview.h - webkit webview widget header
+ *
+ * Copyright © 2011 Mason Larobina <mason.larobina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LUAKIT_WIDGETS_WEBVIEW_H
+#define LUAKIT_WIDGETS_WEBVIEW_H
+
+#include <lua.h>
+
+gint luaH_webview_register_script(lua_State *L);
+gint luaH_webview_unregister_script(lua_State *L);
+gint luaH_webview_push_all_stats(lua_State *L);
+gint luaH_webview_push_host_load_timing(lua_State *L);
+
+#endif
+
+// vim: ft=c:et:sw=4:ts=8:sts=4:tw=80
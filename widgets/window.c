@@ -22,6 +22,7 @@
 #include "luah.h"
 #include "widgets/common.h"
 #include "clib/soup/auth.h"
+#include "common/trace.h"
 
 static void
 destroy_cb(GtkObject *win, widget_t *w)
@@ -53,6 +54,12 @@ luaH_window_show(lua_State *L)
     widget_t *w = luaH_checkwidget(L, 1);
     gtk_widget_show(w->widget);
     gdk_window_set_events(gtk_widget_get_window(w->widget), GDK_ALL_EVENTS_MASK);
+
+    /* end the startup trace span of the window (see widget_window) */
+    if (g_object_get_data(G_OBJECT(w->widget), "trace")) {
+        g_object_set_data(G_OBJECT(w->widget), "trace", NULL);
+        trace_end("startup", "window");
+    }
     return 0;
 }
 
@@ -120,9 +127,15 @@ widget_window(widget_t *w)
     w->newindex = luaH_window_newindex;
     w->destructor = widget_destructor;
 
+    /* the window span lasts until the window is first shown (i.e. includes
+     * building the rest of the window in lua) */
+    trace_begin("startup", "window");
+
     /* create and setup window widget */
     w->widget = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     g_object_set_data(G_OBJECT(w->widget), "lua_widget", (gpointer) w);
+    g_object_set_data(G_OBJECT(w->widget), "trace",
+            GINT_TO_POINTER(trace_enabled()));
     gtk_window_set_wmclass(GTK_WINDOW(w->widget), "luakit", "luakit");
     gtk_window_set_default_size(GTK_WINDOW(w->widget), 800, 600);
     gtk_window_set_title(GTK_WINDOW(w->widget), "luakit");